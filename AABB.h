@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Vector.h>
+#include <algorithm>
+
+struct AABB {
+
+public:
+	FlatVector Min, Max;
+
+	AABB() : Min(0.0f, 0.0f), Max(0.0f, 0.0f) {}
+
+	AABB(const FlatVector& Min, const FlatVector& Max) : Min(Min), Max(Max) {}
+
+	static bool Overlap(const AABB& a, const AABB& b) {
+		if (a.Max.x < b.Min.x || b.Max.x < a.Min.x) return false;
+		if (a.Max.y < b.Min.y || b.Max.y < a.Min.y) return false;
+		return true;
+	}
+
+	static AABB Union(const AABB& a, const AABB& b) {
+		return AABB(FlatVector(std::min(a.Min.x, b.Min.x), std::min(a.Min.y, b.Min.y)),
+			FlatVector(std::max(a.Max.x, b.Max.x), std::max(a.Max.y, b.Max.y)));
+	}
+
+	bool Contains(const AABB& other) const {
+		return Min.x <= other.Min.x && Min.y <= other.Min.y && other.Max.x <= Max.x && other.Max.y <= Max.y;
+	}
+
+	float Perimeter() const {
+		return 2.0f * ((Max.x - Min.x) + (Max.y - Min.y));
+	}
+
+	AABB Fattened(float margin) const {
+		return AABB(Min - FlatVector(margin, margin), Max + margin);
+	}
+};
+
+struct BodyPair {
+	int A, B;
+
+	BodyPair() : A(0), B(0) {}
+
+	BodyPair(int A, int B) : A(A), B(B) {}
+};
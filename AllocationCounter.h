@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Debug count of heap allocations, used to check that World::Step allocates nothing once its buffers
+// have grown. Define PHYSICS_COUNT_ALLOCATIONS before including this header in exactly one translation
+// unit of a program to replace the global operator new and delete; without it the count stays zero.
+class AllocationCounter {
+public:
+
+	static size_t GetCount() {
+		return Count().load(std::memory_order_relaxed);
+	}
+
+	static bool IsEnabled() {
+#ifdef PHYSICS_COUNT_ALLOCATIONS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	static void Record() {
+		Count().fetch_add(1, std::memory_order_relaxed);
+	}
+
+private:
+	static std::atomic<size_t>& Count() {
+		static std::atomic<size_t> count(0);
+		return count;
+	}
+};
+
+#ifdef PHYSICS_COUNT_ALLOCATIONS
+// GCC sees through these operators once they are inlined and warns that memory from operator new is
+// released with free. Both sides are replaced here with malloc and free, so the pairing is right.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(std::size_t size) {
+	AllocationCounter::Record();
+	if (void* memory = std::malloc(size > 0 ? size : 1)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+void operator delete[](void* memory) noexcept {
+	std::free(memory);
+}
+void operator delete(void* memory, std::size_t) noexcept {
+	std::free(memory);
+}
+void operator delete[](void* memory, std::size_t) noexcept {
+	std::free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
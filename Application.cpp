@@ -5,11 +5,12 @@
 #include <cmath>
 #include <cstdlib>
 #include <ctime>
-#include <random>
 #include <string>
 #include <chrono>
+#include <array>
 
 #include <World.h>
+#include <Scene.h>
 
 float zoom = 20.0f;
 FlatVector cameraPosition(0.0f, 0.0f);
@@ -17,69 +18,21 @@ World MyWorld;
 FlatVector clickPosition(0.0f, 0.0f);
 bool isMousePressed = false;
 
-float RandomFloatInRange(float min, float max) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> dis(min, max);
-    return dis(gen);
-}
-
-void CreateBoundaries(World& MyWorld) {
-    FlatVector Vector1 = FlatVector(-20.0f, -15.0f);
-    FlatVector Vector2 = FlatVector(20.0f, -15.5f);
-    Materials steelMaterial = Materials::CreateSteel();
-    Bodies body1 = Bodies(Bodies::CreatePolygonBody(Vector1, Vector2, 0.2f, 1, steelMaterial));
-    MyWorld.AddBody(body1);
-
-    Vector1 = FlatVector(-21.0f, -15.0f);
-    Vector2 = FlatVector(-20.0f, 15.5f);
-    MyWorld.AddBody(Bodies::CreatePolygonBody(Vector1, Vector2, 0.8f, 1, steelMaterial));
-
-    Vector1 = FlatVector(20.0f, -15.0f);
-    Vector2 = FlatVector(21.0f, 15.5f);
-    Bodies body3 = Bodies::CreatePolygonBody(Vector1, Vector2, 0.8f, 1, steelMaterial);
-    MyWorld.AddBody(body3);
-}
 void CreateBodies(World& MyWorld) {
-    CreateBoundaries(MyWorld);
+    SceneBuilder scene(12345);                                                              // Fixed seed, so every run builds the same scene
+    scene.AddContainer(FlatVector(-20.0f, -15.0f), FlatVector(20.0f, 15.5f));
 
-    for (int i = 0; i <10; i++) {
-        FlatVector Position = FlatVector(RandomFloatInRange(-10, 10), RandomFloatInRange(-15, 15));
-        float radius = RandomFloatInRange(0.3f,1.1f);
-        if (i % 2) {
-            MyWorld.AddBody(Bodies::CreateCircleBody(Position, radius, 0.8f, 0, Materials::CreateBirch()));
-        }
-        else if (i % 3) {
-            MyWorld.AddBody(Bodies::CreateCircleBody(Position, radius, 0.8f, 0, Materials::CreateGlass()));
-        }
-        else { MyWorld.AddBody(Bodies::CreateCircleBody(Position, radius, 0.8f, 0, Materials::CreateSteel())); }
-        
-    }
-    for (int j = 0; j < 5; j++) {
-        FlatVector Position = FlatVector(RandomFloatInRange(-10, 10), RandomFloatInRange(-10, 10));
-        float radiusBox = RandomFloatInRange(1, 2);
-        auto body = Bodies::CreatePolygonBody(4, Position, radiusBox, 0.4f, 0, Materials::CreateBirch());
-        //body.Rotate(3.1415 * j / 3 + j);
-        //body.Rotate(3.1415 /4);
-        MyWorld.AddBody(body);
-    }
-    for (int j = 0; j < 0; j++) {
-        FlatVector Position = FlatVector(RandomFloatInRange(-5, 5), RandomFloatInRange(-5, 5));
-        FlatVector Rand = FlatVector(RandomFloatInRange(-4, -0.1), RandomFloatInRange(-4, -0.1));
-        FlatVector Vec0 = Rand+Position;
-        Rand = FlatVector(RandomFloatInRange(0.1, 4), RandomFloatInRange(0.1, 4));
-        FlatVector Vec1 = Rand+Position;
-
-        Bodies body = Bodies::CreatePolygonBody(Vec0, Vec1, 0.4f, 0, Materials::CreateBirch());
-        body.Rotate(3.1415 * j / 3 + j);
-        //body.Rotate(3.1415 /4);
-        MyWorld.AddBody(body);
-    }
-    //std::vector<FlatVector> WaterBoundries = { FlatVector(-20.0f,0.0f), FlatVector(20.0f,0.0f), FlatVector(20.0f,-15.0f), FlatVector(-20.0f,-15.0f)};
-    //MyWorld.AddLiquid(Liquids::CreateBodyOfWater(WaterBoundries));
+    std::vector<SceneShape> circles = { SceneShape::Circle(1.1f, Materials::CreateBirch(), 0.8f),
+        SceneShape::Circle(1.1f, Materials::CreateGlass(), 0.8f), SceneShape::Circle(1.1f, Materials::CreateSteel(), 0.8f) };
+    scene.AddRandomFill(FlatVector(-10.0f, -15.0f), FlatVector(10.0f, 15.0f), 10, circles, 0.3f / 1.1f);
+    scene.AddRandomFill(FlatVector(-10.0f, -10.0f), FlatVector(10.0f, 10.0f), 5, { SceneShape::Polygon(4, 2.0f, Materials::CreateBirch()) }, 0.5f);
+
+    //scene.AddLiquidTank(FlatVector(-20.0f, -15.0f), FlatVector(20.0f, 15.5f), 0.0f);
+    //scene.AddFluidBlock(FlatVector(-20.0f, -15.0f), FlatVector(-10.0f, -12.0f));          // Particle fluid, 3000 particles at the default spacing
+    scene.AddTo(MyWorld);
 }
 
-void DrawCircle(const FlatVector& center, float radius, std::vector<float> color) {
+void DrawCircle(const FlatVector& center, float radius, const std::array<float, 3>& color) {
     int numSegments = 100;
     glBegin(GL_TRIANGLE_FAN);
     glColor3f(color[0], color[1], color[2]);
@@ -93,16 +46,18 @@ void DrawCircle(const FlatVector& center, float radius, std::vector<float> color
     glEnd();
 }
 
-void DrawPolygon(FlatVector& Position, std::vector<FlatVector>& Vertices, std::vector<float> color) {
+void DrawPolygon(const FlatVector& Position, float Rotation, float Scale, const std::vector<FlatVector>& Vertices, const std::array<float, 3>& color) {
+    float cosine = cosf(Rotation) * Scale;
+    float sine = sinf(Rotation) * Scale;
     glBegin(GL_POLYGON);
     glColor3f(color[0], color[1], color[2]);
-    for (auto& vertex : Vertices) {
-        glVertex2f(Position.x + vertex.x, Position.y + vertex.y);
+    for (const auto& vertex : Vertices) {
+        glVertex2f(Position.x + vertex.x * cosine - vertex.y * sine, Position.y + vertex.x * sine + vertex.y * cosine);
     }
     glEnd();
 }
 
-void DrawLiquid(std::vector<FlatVector>& Vertices) {
+void DrawLiquid(const std::vector<FlatVector>& Vertices) {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -118,22 +73,35 @@ void DrawLiquid(std::vector<FlatVector>& Vertices) {
     glDisable(GL_BLEND);
 }
 
+void DrawFluid(const std::vector<FlatVector>& Particles) {
+    glPointSize(3.0f);
+    glBegin(GL_POINTS);
+    glColor3f(0.2f, 0.4f, 1.0f);
+    for (const auto& particle : Particles) {
+        glVertex2f(particle.x, particle.y);
+    }
+    glEnd();
+}
+
 void DrawBodies(World& MyWorld) {
     
-    for (int i = 0; i < MyWorld.BodyListSize(); i++) {
-        Bodies* Body = MyWorld.GetBody(i);
-
-        if (Body->Type == Bodies::Circle) {
-            DrawCircle(Body->Position, Body->Radius, Body->Material.Color);
+    const WorldSnapshot& Snapshot = MyWorld.AcquireSnapshot();                              // Only the snapshot is read, the physics thread owns the world
+    for (size_t i = 0; i < Snapshot.BodyCount(); i++) {
+        int ShapeId = Snapshot.ShapeIds[i];
+        const std::array<float, 3>& Color = Snapshot.MaterialColors[Snapshot.MaterialIds[i]];
+        FlatVector Position = Snapshot.GetInterpolatedPosition(static_cast<int>(i));
+
+        if (Snapshot.ShapeTypes[ShapeId] == Bodies::Circle) {
+            DrawCircle(Position, Snapshot.Radii[i], Color);
         }
-        else if (Body->Type == Bodies::Polygon) {
-            DrawPolygon(Body->Position, Body->Vertices, Body->Material.Color);
+        else if (Snapshot.ShapeTypes[ShapeId] == Bodies::Polygon) {
+            DrawPolygon(Position, Snapshot.Rotations[i], Snapshot.Scales[i], Snapshot.ShapeVertices[ShapeId], Color);
         }
     }
-    for (int i = 0; i < MyWorld.LiquidListSize(); i++) {
-        Liquids* Liquid = MyWorld.GetLiquid(i);
-        DrawLiquid(Liquid->FluidBoundries);
+    for (const auto& Outline : Snapshot.LiquidOutlines) {
+        DrawLiquid(Outline);
     }
+    DrawFluid(Snapshot.FluidPositions);
 }
 void drawAxes() {
     glBegin(GL_LINES);
@@ -166,7 +134,7 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
         }
     }
 }
-void HandleArrowKeys(GLFWwindow* window, Bodies& BodyToMove) {
+void HandleArrowKeys(GLFWwindow* window, World& MyWorld, const BodyHandle& BodyToMove) {
     float movementSpeed = 0.01f;
     FlatVector movementAmount = { 0.0f, 0.0f };
     if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
@@ -181,7 +149,7 @@ void HandleArrowKeys(GLFWwindow* window, Bodies& BodyToMove) {
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
         movementAmount.x = movementSpeed;
     }
-    BodyToMove.Move(movementAmount);
+    MyWorld.QueueMoveBody(BodyToMove, movementAmount); // applied by the intersection thread
 }
 void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos) {
     static double lastX = xpos, lastY = ypos;
@@ -210,6 +178,8 @@ int main(void) {
     }
 
     CreateBodies(MyWorld);                                                                  // Create the bodies for the physics simulation
+    MyWorld.SetFixedTimestep(true, 120.0f, 8);                                              // Step at 120 Hz, catching up at most 8 steps per update
+    MyWorld.SetSleeping(true);                                                              // Let settled islands sleep
 
     glfwMakeContextCurrent(window);                                                         // Make the window's context current
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);                      // Set the framebuffer size callback
@@ -235,8 +205,7 @@ int main(void) {
         glMatrixMode(GL_MODELVIEW);
 
         //Uncomment to move a specific body with arrow keys
-        //Bodies* BodyToMove = MyWorld.GetBody(1);
-        //HandleArrowKeys(window, *BodyToMove);
+        //HandleArrowKeys(window, MyWorld, BodyHandle(1, 0)); // second body added
 
         drawAxes();                     // Draw the coordinate axes
         DrawBodies(MyWorld);            // Draw all the bodies in the world
@@ -0,0 +1,537 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define PHYSICS_COUNT_ALLOCATIONS
+#include <AllocationCounter.h>
+#include <World.h>
+#include <Scene.h>
+
+// Headless benchmark: builds reproducible scenes with SceneBuilder, runs a fixed number of
+// steps and writes one JSON object per run (JSON Lines) for regression tracking.
+
+struct BenchmarkOptions {
+    std::string Scene = "all";
+    std::string BroadPhase = "all";
+    int Steps = 300;
+    int WarmupSteps = 10;
+    int BodyCount = 0;          // 0 keeps the scene default
+    int Threads = 1;
+    int Iterations = 8;         // contact solver iterations
+    bool Sleeping = false;
+    bool CheckAllocations = false;  // fail when a step after warm-up allocates
+    bool CheckKernels = false;      // compare every SatKernels level with the scalar reference instead of running scenes
+    float DeltaTime = 1.0f / 120.0f;
+    unsigned int Seed = 12345;
+    std::string OutputPath;
+    std::string TracePath;      // Chrome trace per run, needs PHYSICS_PROFILING
+};
+
+// A resting column whose top box moves farther than this fails the run
+constexpr float MaxTopDrift = 0.05f;
+
+struct BenchmarkResult {
+    std::string Scene;
+    std::string BroadPhase;
+    size_t BodyCount = 0;
+    size_t ParticleCount = 0;   // particles of the world's ParticleFluid
+    int Threads = 1;
+    double LoadSeconds = 0.0;   // scene generation and bulk insertion
+    int Steps = 0;
+    double Seconds = 0.0;
+    double CandidatePairs = 0.0;
+    double Contacts = 0.0;
+    long PeakRssKb = 0;
+    size_t StepAllocations = 0;
+    float TopDrift = 0.0f;      // tall_stack: farthest the top box moved sideways from where it was built
+    WorldStats Stats;           // per-phase timings of the last Profiler::Window steps
+};
+
+long PeakRssKb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<long>(usage.ru_maxrss / 1024);
+#else
+    return static_cast<long>(usage.ru_maxrss);
+#endif
+#endif
+}
+
+// Circles dropped on a jittered grid into a container
+void CreateCirclePile(SceneBuilder& scene, int count) {
+    int columns = 60;
+    float spacing = 1.0f;
+    float halfWidth = columns * spacing / 2.0f + 1.0f;
+    scene.AddContainer(FlatVector(-halfWidth, -20.0f), FlatVector(halfWidth, 280.0f));
+
+    scene.Reserve(count);
+    SceneRandom& random = scene.GetRandom();
+    for (int i = 0; i < count; i++) {
+        FlatVector Position = FlatVector((i % columns - columns / 2) * spacing + random.Range(-0.1f, 0.1f),
+            -19.0f + (i / columns) * spacing);
+        float radius = random.Range(0.3f, 0.45f);
+        scene.AddBody(SceneShape::Circle(radius, i % 2 ? Materials::CreateBirch() : Materials::CreateGlass()).Create(Position));
+    }
+}
+
+// Columns of boxes resting on each other from the first step, so the run measures the solver on
+// settled stacks. Regular polygons are exercised by mixed_water.
+void CreateBoxStack(SceneBuilder& scene, int count) {
+    int columns = 20;
+    scene.AddContainer(FlatVector(-columns * 1.5f, -20.0f), FlatVector(columns * 1.5f, 280.0f));
+
+    SceneShape box = SceneShape::Box(1.0f, 1.0f, Materials::CreateOak());
+    scene.Reserve(count);
+    for (int i = 0; i < count; i++) {
+        FlatVector Position = FlatVector((i % columns - columns / 2) * 3.0f, -19.5f + (i / columns) * 1.0f);
+        scene.AddBody(box.Create(Position));
+    }
+}
+
+// A column of boxes next to a pyramid, both resting from the first step. The column is added last,
+// so its top box is the last body and RunBenchmark can follow it.
+void CreateTallStack(SceneBuilder& scene, int count) {
+    scene.AddContainer(FlatVector(-10.0f, -20.0f), FlatVector(14.0f, 280.0f));
+
+    SceneShape box = SceneShape::Box(1.0f, 1.0f, Materials::CreateOak());
+    scene.AddPyramid(FlatVector(6.0f, -20.0f), 10, box);
+    scene.AddStack(FlatVector(-4.0f, -20.0f), count, box);
+}
+
+// Circles, regular polygons and boxes falling into a water tank
+void CreateMixedInWater(SceneBuilder& scene, int count) {
+    float halfWidth = 30.0f;
+    scene.AddLiquidTank(FlatVector(-halfWidth, -20.0f), FlatVector(halfWidth, 180.0f), 0.0f);
+
+    scene.Reserve(count);
+    SceneRandom& random = scene.GetRandom();
+    for (int i = 0; i < count; i++) {
+        FlatVector Position = FlatVector(random.Range(-halfWidth + 2.0f, halfWidth - 2.0f), random.Range(-15.0f, 150.0f));
+
+        if (i % 3 == 0) {
+            scene.AddBody(SceneShape::Circle(random.Range(0.3f, 0.8f), Materials::CreateBirch(), 0.6f).Create(Position));
+        }
+        else if (i % 3 == 1) {
+            scene.AddBody(SceneShape::Polygon(3 + i % 5, random.Range(0.4f, 0.9f), Materials::CreateAluminum()).Create(Position));
+        }
+        else {
+            scene.AddBody(SceneShape::Box(random.Range(1.0f, 1.6f), random.Range(1.0f, 1.6f), Materials::CreateOak()).Create(Position));
+        }
+    }
+}
+
+// Sparse, weightless circles with random velocities and no container
+void CreateGas(World& MyWorld, SceneBuilder& scene, int count) {
+    MyWorld.SetGravity(FlatVector(0.0f, 0.0f));
+    float halfExtent = std::sqrt(static_cast<float>(count)) * 2.0f;
+    scene.AddRandomFill(FlatVector(-halfExtent, -halfExtent), FlatVector(halfExtent, halfExtent), count,
+        { SceneShape::Circle(0.4f, Materials::CreateSteel(), 0.9f) }, 0.5f, 2.0f);
+}
+
+// A 200 m wide pool of 100k fluid particles, 5 m deep, with floating boxes and circles dropped in
+void CreateParticlePool(SceneBuilder& scene, int count) {
+    float halfWidth = 100.0f;
+    scene.AddContainer(FlatVector(-halfWidth, 0.0f), FlatVector(halfWidth, 20.0f));
+    scene.AddFluidBlock(FlatVector(-halfWidth, 0.0f), FlatVector(halfWidth, 5.0f));
+
+    std::vector<SceneShape> shapes = { SceneShape::Box(1.6f, 0.8f, Materials::CreateOak()),
+        SceneShape::Box(1.0f, 1.0f, Materials::CreateBirch()), SceneShape::Circle(0.6f, Materials::CreateBirch()) };
+    scene.AddRandomFill(FlatVector(-halfWidth + 2.0f, 6.0f), FlatVector(halfWidth - 2.0f, 18.0f), count, shapes);
+}
+
+// Every scene is generated from the seed alone and added to the world in one bulk insertion
+bool CreateScene(World& MyWorld, const std::string& scene, int bodies, unsigned int seed) {
+    SceneBuilder builder(seed);
+
+    if (scene == "circle_pile") CreateCirclePile(builder, bodies > 0 ? bodies : 2000);
+    else if (scene == "box_stack") CreateBoxStack(builder, bodies > 0 ? bodies : 400);
+    else if (scene == "tall_stack") CreateTallStack(builder, bodies > 0 ? bodies : 15);
+    else if (scene == "mixed_water") CreateMixedInWater(builder, bodies > 0 ? bodies : 1000);
+    else if (scene == "gas") CreateGas(MyWorld, builder, bodies > 0 ? bodies : 100000);
+    else if (scene == "fluid") CreateParticlePool(builder, bodies > 0 ? bodies : 200);
+    else return false;
+
+    builder.AddTo(MyWorld);
+    return true;
+}
+
+bool ParseBroadPhase(const std::string& name, World::BroadPhaseType& type) {
+    if (name == "allpairs") type = World::AllPairs;
+    else if (name == "grid") type = World::SpatialHash;
+    else if (name == "tree") type = World::DynamicAABBTree;
+    else if (name == "sap") type = World::SweepPrune;
+    else return false;
+
+    return true;
+}
+
+// One trace per run: trace.json becomes trace_box_stack_tree.json
+std::string TracePath(const std::string& path, const std::string& scene, const std::string& broadPhase) {
+    std::string suffix = "_" + scene + "_" + broadPhase;
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return path + suffix;
+    }
+    return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+BenchmarkResult RunBenchmark(const std::string& scene, const std::string& broadPhase, const BenchmarkOptions& options) {
+    BenchmarkResult result;
+    result.Scene = scene;
+    result.BroadPhase = broadPhase;
+
+    World::BroadPhaseType type = World::SpatialHash;
+    if (!ParseBroadPhase(broadPhase, type)) {
+        return result;
+    }
+
+    World MyWorld;
+    MyWorld.SetBroadPhase(type);
+    MyWorld.SetWorkerCount(options.Threads);
+    MyWorld.SetSolverIterations(options.Iterations);
+    MyWorld.SetSleeping(options.Sleeping);
+    std::chrono::steady_clock::time_point loadTime = std::chrono::steady_clock::now();
+    CreateScene(MyWorld, scene, options.BodyCount, options.Seed);
+    std::chrono::duration<double> loadElapsed = std::chrono::steady_clock::now() - loadTime;
+
+    const BodyStore& store = MyWorld.GetBodyStore();
+    int top = scene == "tall_stack" ? static_cast<int>(MyWorld.BodyListSize()) - 1 : -1;
+    float topX = top >= 0 ? store.Positions[top].x : 0.0f;
+
+    MyWorld.StepN(options.DeltaTime, options.WarmupSteps);
+
+    result.BodyCount = MyWorld.BodyListSize();
+    result.ParticleCount = MyWorld.GetParticleFluid().Size();
+    result.Threads = MyWorld.GetWorkerCount();
+    result.Steps = options.Steps;
+    result.LoadSeconds = loadElapsed.count();
+
+    double candidatePairs = 0.0;
+    double contacts = 0.0;
+    if (!options.TracePath.empty()) {
+        MyWorld.StartTrace();
+    }
+    size_t allocations = AllocationCounter::GetCount();
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.Steps; i++) {
+        MyWorld.Step(options.DeltaTime);
+        candidatePairs += MyWorld.GetCandidatePairCount();
+        contacts += MyWorld.GetContactCount();
+        if (top >= 0) {
+            result.TopDrift = std::max(result.TopDrift, std::fabs(store.Positions[top].x - topX));
+        }
+    }
+    std::chrono::duration<double> timeElapsed = std::chrono::steady_clock::now() - startTime;
+    result.StepAllocations = AllocationCounter::GetCount() - allocations;
+    result.Stats = MyWorld.GetStats();
+
+    if (!options.TracePath.empty()) {
+        MyWorld.StopTrace();
+        std::string path = TracePath(options.TracePath, scene, broadPhase);
+        if (!MyWorld.WriteChromeTrace(path)) {
+            std::cerr << "Could not write trace " << path << "\n";
+        }
+    }
+
+    result.Seconds = timeElapsed.count();
+    result.CandidatePairs = options.Steps > 0 ? candidatePairs / options.Steps : 0.0;
+    result.Contacts = options.Steps > 0 ? contacts / options.Steps : 0.0;
+    result.PeakRssKb = PeakRssKb();
+    return result;
+}
+
+std::string ToJson(const BenchmarkResult& result) {
+    double stepsPerSecond = result.Seconds > 0.0 ? result.Steps / result.Seconds : 0.0;
+    double bodySteps = static_cast<double>(result.Steps) * result.BodyCount;
+    double nsPerBodyStep = bodySteps > 0.0 ? result.Seconds * 1e9 / bodySteps : 0.0;
+
+    std::ostringstream os;
+    os << "{\"scene\":\"" << result.Scene << "\""
+        << ",\"broadphase\":\"" << result.BroadPhase << "\""
+        << ",\"bodies\":" << result.BodyCount
+        << ",\"particles\":" << result.ParticleCount
+        << ",\"threads\":" << result.Threads
+        << ",\"steps\":" << result.Steps
+        << ",\"load_seconds\":" << result.LoadSeconds
+        << ",\"seconds\":" << result.Seconds
+        << ",\"steps_per_sec\":" << stepsPerSecond
+        << ",\"ns_per_body_step\":" << nsPerBodyStep
+        << ",\"candidate_pairs\":" << result.CandidatePairs
+        << ",\"contacts\":" << result.Contacts
+        << ",\"peak_rss_kb\":" << result.PeakRssKb
+        << ",\"step_allocations\":" << result.StepAllocations;
+    if (result.Scene == "tall_stack") {
+        os << ",\"top_drift\":" << result.TopDrift;
+    }
+
+    // Phase percentiles only mean something in a PHYSICS_PROFILING build
+    if (Profiler::IsEnabled() && result.Stats.Samples > 0) {
+        os << ",\"phases\":{";
+        for (int p = 0; p < ProfilePhaseCount; p++) {
+            const PhaseStats& phase = result.Stats.Phases[p];
+            os << (p ? "," : "") << "\"" << Profiler::GetPhaseName(static_cast<ProfilePhase>(p)) << "\":{"
+                << "\"mean_ms\":" << phase.MeanMs << ",\"p50_ms\":" << phase.P50Ms
+                << ",\"p95_ms\":" << phase.P95Ms << ",\"p99_ms\":" << phase.P99Ms << "}";
+        }
+        os << "}";
+    }
+    os << "}";
+    return os.str();
+}
+
+// Random convex polygon for the kernel check, as local vertices for the scalar reference and as
+// world vertices with edge normals for the batched functions
+struct KernelShape {
+    FlatVector Center;
+    std::vector<FlatVector> LocalVertices;
+    std::vector<FlatVector> WorldVertices;
+    std::vector<FlatVector> Normals;
+};
+
+struct KernelResult {
+    bool Hit = false;
+    float Depth = 0.0f;
+};
+
+KernelShape CreateKernelShape(SceneRandom& random) {
+    KernelShape shape;
+    shape.Center = FlatVector(random.Range(-2.0f, 2.0f), random.Range(-2.0f, 2.0f));
+    float rotation = random.Range(0.0f, 6.2831853f);
+    float cosine = std::cos(rotation);
+    float sine = std::sin(rotation);
+
+    for (const FlatVector& vertex : Bodies::CreatePolygonVertices(random.Range(3, 16), random.Range(0.3f, 1.5f))) {
+        FlatVector local = FlatVector(vertex.x * cosine - vertex.y * sine, vertex.x * sine + vertex.y * cosine);
+        shape.LocalVertices.push_back(local);
+        shape.WorldVertices.push_back(local + shape.Center);
+    }
+    shape.Normals = Bodies::CreateEdgeNormals(shape.WorldVertices);
+    return shape;
+}
+
+// Counts results that disagree with the reference. Touching pairs may fall either way and axes of
+// almost equal depth may swap, so hits are compared outside the tolerance and only depths are compared.
+int CountKernelMismatches(const std::vector<KernelResult>& results, const std::vector<KernelResult>& reference, float& maxDepthError) {
+    const float tolerance = 1e-4f;
+    int mismatches = 0;
+    maxDepthError = 0.0f;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].Hit != reference[i].Hit) {
+            float depth = results[i].Hit ? results[i].Depth : reference[i].Depth;
+            if (depth > tolerance) mismatches++;
+            continue;
+        }
+        if (!results[i].Hit) continue;
+
+        float error = std::fabs(results[i].Depth - reference[i].Depth);
+        maxDepthError = std::max(maxDepthError, error);
+        if (error > tolerance) mismatches++;
+    }
+    return mismatches;
+}
+
+std::string KernelJson(const std::string& kernel, const std::string& level, size_t pairs, double seconds, int mismatches, float maxDepthError) {
+    std::ostringstream os;
+    os << "{\"kernel\":\"" << kernel << "\""
+        << ",\"level\":\"" << level << "\""
+        << ",\"pairs\":" << pairs
+        << ",\"ns_per_pair\":" << (pairs > 0 ? seconds * 1e9 / pairs : 0.0)
+        << ",\"mismatches\":" << mismatches
+        << ",\"max_depth_error\":" << maxDepthError << "}";
+    return os.str();
+}
+
+// Runs the polygon and circle-polygon tests of every SatKernels level the CPU supports on the same
+// random pairs as the scalar reference functions and reports the time per pair and the disagreements
+bool CheckKernels(const BenchmarkOptions& options, std::ostream& out) {
+    const int pairCount = 100000;
+    const char* levelNames[] = { "scalar", "sse", "avx" };
+
+    SceneRandom random(options.Seed);
+    std::vector<KernelShape> shapesA, shapesB;
+    std::vector<float> radii;
+    shapesA.reserve(pairCount);
+    shapesB.reserve(pairCount);
+    radii.reserve(pairCount);
+    for (int i = 0; i < pairCount; i++) {
+        shapesA.push_back(CreateKernelShape(random));
+        shapesB.push_back(CreateKernelShape(random));
+        radii.push_back(random.Range(0.2f, 1.5f));
+    }
+
+    std::vector<KernelResult> polygonReference(pairCount), circleReference(pairCount), results(pairCount);
+    FlatVector normal;
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    for (int i = 0; i < pairCount; i++) {
+        KernelResult& result = polygonReference[i];
+        result.Hit = Intersections::IntersectPolygonsScalar(shapesA[i].Center, shapesA[i].LocalVertices,
+            shapesB[i].Center, shapesB[i].LocalVertices, normal, result.Depth);
+    }
+    std::chrono::duration<double> polygonElapsed = std::chrono::steady_clock::now() - startTime;
+    out << KernelJson("polygons", "reference", pairCount, polygonElapsed.count(), 0, 0.0f) << std::endl;
+
+    startTime = std::chrono::steady_clock::now();
+    for (int i = 0; i < pairCount; i++) {
+        KernelResult& result = circleReference[i];
+        result.Hit = Intersections::IntersectCirclePolygonScalar(shapesA[i].Center, radii[i],
+            shapesB[i].Center, shapesB[i].LocalVertices, normal, result.Depth);
+    }
+    std::chrono::duration<double> circleElapsed = std::chrono::steady_clock::now() - startTime;
+    out << KernelJson("circle_polygon", "reference", pairCount, circleElapsed.count(), 0, 0.0f) << std::endl;
+
+    bool matched = true;
+    for (int level = SatKernels::Scalar; level <= SatKernels::AVX; level++) {
+        SatKernels::SetLevel(static_cast<SatKernels::Level>(level));
+        if (SatKernels::GetLevel() != level) continue; // not supported by this CPU
+
+        float maxDepthError = 0.0f;
+        startTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < pairCount; i++) {
+            KernelResult& result = results[i];
+            result.Hit = Intersections::IntersectPolygons(shapesA[i].Center, shapesA[i].WorldVertices, shapesA[i].Normals,
+                shapesB[i].Center, shapesB[i].WorldVertices, shapesB[i].Normals, normal, result.Depth);
+        }
+        polygonElapsed = std::chrono::steady_clock::now() - startTime;
+        int mismatches = CountKernelMismatches(results, polygonReference, maxDepthError);
+        out << KernelJson("polygons", levelNames[level], pairCount, polygonElapsed.count(), mismatches, maxDepthError) << std::endl;
+        matched = matched && mismatches == 0;
+
+        startTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < pairCount; i++) {
+            KernelResult& result = results[i];
+            result.Hit = Intersections::IntersectCirclePolygon(shapesA[i].Center, radii[i],
+                shapesB[i].Center, shapesB[i].WorldVertices, shapesB[i].Normals, normal, result.Depth);
+        }
+        circleElapsed = std::chrono::steady_clock::now() - startTime;
+        mismatches = CountKernelMismatches(results, circleReference, maxDepthError);
+        out << KernelJson("circle_polygon", levelNames[level], pairCount, circleElapsed.count(), mismatches, maxDepthError) << std::endl;
+        matched = matched && mismatches == 0;
+    }
+    SatKernels::SetLevel(SatKernels::DetectLevel());
+
+    if (!matched) {
+        std::cerr << "SAT kernels disagree with the scalar reference\n";
+    }
+    return matched;
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: benchmark [--scene circle_pile|box_stack|tall_stack|mixed_water|gas|fluid|all] [--broadphase allpairs|grid|tree|sap|all]\n"
+        << "                 [--steps N] [--warmup N] [--bodies N] [--threads N] [--sleeping 0|1] [--seed N] [--out results.jsonl]\n"
+        << "                 [--hz N] [--iterations N]\n"
+        << "                 [--check-allocations 0|1] [--check-kernels 0|1] [--trace trace.json]\n"
+        << "Peak RSS is process-wide, run one scene per process for per-scene memory numbers.\n";
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage();
+            return 1;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--scene") options.Scene = value;
+        else if (arg == "--broadphase") options.BroadPhase = value;
+        else if (arg == "--steps") options.Steps = std::atoi(value.c_str());
+        else if (arg == "--warmup") options.WarmupSteps = std::atoi(value.c_str());
+        else if (arg == "--bodies") options.BodyCount = std::atoi(value.c_str());
+        else if (arg == "--threads") options.Threads = std::atoi(value.c_str());
+        else if (arg == "--hz") options.DeltaTime = 1.0f / std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--iterations") options.Iterations = std::atoi(value.c_str());
+        else if (arg == "--sleeping") options.Sleeping = std::atoi(value.c_str()) != 0;
+        else if (arg == "--seed") options.Seed = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (arg == "--out") options.OutputPath = value;
+        else if (arg == "--check-allocations") options.CheckAllocations = std::atoi(value.c_str()) != 0;
+        else if (arg == "--check-kernels") options.CheckKernels = std::atoi(value.c_str()) != 0;
+        else if (arg == "--trace") options.TracePath = value;
+        else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    std::vector<std::string> scenes = { "circle_pile", "box_stack", "tall_stack", "mixed_water", "gas", "fluid" };
+    std::vector<std::string> broadPhases = { "allpairs", "grid", "tree", "sap" };
+
+    if (options.Scene != "all") {
+        if (std::find(scenes.begin(), scenes.end(), options.Scene) == scenes.end()) {
+            PrintUsage();
+            return 1;
+        }
+        scenes = { options.Scene };
+    }
+    if (options.BroadPhase != "all") {
+        World::BroadPhaseType type = World::SpatialHash;
+        if (!ParseBroadPhase(options.BroadPhase, type)) {
+            PrintUsage();
+            return 1;
+        }
+        broadPhases = { options.BroadPhase };
+    }
+
+    std::ofstream file;
+    if (!options.OutputPath.empty()) {
+        file.open(options.OutputPath, std::ios::app);
+    }
+    std::ostream& out = file.is_open() ? file : std::cout;
+
+    if (options.CheckKernels) {
+        return CheckKernels(options, out) ? 0 : 3;
+    }
+    bool allocated = false;
+    bool drifted = false;
+
+    for (const auto& scene : scenes) {
+        for (const auto& broadPhase : broadPhases) {
+            // The quadratic reference loop is only run on large scenes when asked for explicitly
+            bool largeScene = options.BodyCount > 5000 || (options.BodyCount == 0 && scene == "gas");
+            if (broadPhase == "allpairs" && options.BroadPhase == "all" && largeScene) {
+                continue;
+            }
+
+            BenchmarkResult result = RunBenchmark(scene, broadPhase, options);
+            out << ToJson(result) << std::endl;
+            std::cerr << scene << " / " << broadPhase << ": " << result.BodyCount << " bodies, "
+                << (result.Seconds > 0.0 ? result.Steps / result.Seconds : 0.0) << " steps/s\n";
+
+            if (options.CheckAllocations && result.StepAllocations > 0) {
+                std::cerr << scene << " / " << broadPhase << ": " << result.StepAllocations << " heap allocations after warm-up\n";
+                allocated = true;
+            }
+            if (result.TopDrift > MaxTopDrift) {
+                std::cerr << scene << " / " << broadPhase << ": top box drifted " << result.TopDrift << " m\n";
+                drifted = true;
+            }
+        }
+    }
+
+    return allocated ? 2 : drifted ? 4 : 0;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <stdexcept>
 
 #include <Materials.h>
 #include <Vector.h>
@@ -14,6 +15,8 @@ private:
 public:
 	FlatVector force;
 	FlatVector Position, FirstVertex, LiquidDisplacement;
+	// Local outline of a box; regular polygons are described by NumberOfVertices and Radius alone and
+	// share one unit n-gon in the world's ShapeRegistry
 	std::vector<FlatVector> Vertices;
 	const bool IsStatic;
 	const float Radius, Area;
@@ -39,7 +42,12 @@ public:
 	void SetlinearVelocity(const FlatVector& newVelocity) {
 		linearVelocity = newVelocity;
 	}
-
+	float GetRotation() const {
+		return rotation;
+	}
+	float GetRotationalVelocity() const {
+		return rotationalVelocity;
+	}
 	Bodies(FlatVector& Position, int NumberOfVertices, float Radius, float Mass, float Area, float Restitution, bool IsStatic, ShapeType Type, Materials Material)
 		: linearVelocity(0.0f, 0.0f),linearVelocitySquered(FlatVector::VecSquared(linearVelocity)), rotation(0.0f), rotationalVelocity(0.0f), force(0.0f, 0.0f), ContactCount(0), Position(Position), NumberOfVertices(NumberOfVertices),
 		Radius(Radius), Density(Material.Density), Mass(Mass), Area(Area), Restitution(Restitution), IsStatic(IsStatic), Type(Type), Material(Material), LiquidDisplacement(FlatVector(0.0f, 0.0f)) {
@@ -49,11 +57,6 @@ public:
 		else {
 			InvMass = 0.0f;
 		}
-
-		if (NumberOfVertices > 2) {
-			Vertices.reserve(NumberOfVertices);
-			Vertices = CreatePolygonVertices(NumberOfVertices, Radius);
-		}
 	}
 
 	static Bodies CreateCircleBody(FlatVector& Position, float Radius, float Restitution, bool IsStatic, Materials Material) {
@@ -78,26 +81,23 @@ public:
 		return Bodies(Position, NumberOfVertices,  Radius, area * Material.Density, area, Restitution, IsStatic, ShapeType::Polygon, Material);
 	}
 	static Bodies CreatePolygonBody(const FlatVector& FirstVertex, const FlatVector& SecondVertex, float Restitution, bool IsStatic, Materials Material) {
-		float Width = std::fabs(FirstVertex.x - SecondVertex.x);
-		float Height = std::fabs(FirstVertex.y - SecondVertex.y);
-		float area = Height * Width;
-
-		FlatVector Position;
-
-		if (FirstVertex != SecondVertex) {
-			Position = FlatVector((SecondVertex.x + FirstVertex.x) / 4, (SecondVertex.y + FirstVertex.y) / 4);
-		}
-		else {
+		if (FirstVertex == SecondVertex) {
 			throw std::invalid_argument("Invalid vertices: FirstVertex is equal to SecondVertex");
 		}
 
+		FlatVector Position = FlatVector((SecondVertex.x + FirstVertex.x) / 2, (SecondVertex.y + FirstVertex.y) / 2);
+		return CreateBoxBody(Position, std::fabs(FirstVertex.x - SecondVertex.x), std::fabs(FirstVertex.y - SecondVertex.y), Restitution, IsStatic, Material);
+	}
+	// Box from its center and size. Equal sizes give bit-equal vertices, so the boxes share one interned shape
+	static Bodies CreateBoxBody(FlatVector& Position, float Width, float Height, float Restitution, bool IsStatic, Materials Material) {
+		float area = Height * Width;
+
 		if (area > 1500.0f || area < 1.0f) {
 			throw std::invalid_argument("Invalid size");
 		}
 
-		Bodies body = Bodies(Position, 0, FlatVector::VecLen((SecondVertex - FirstVertex) / 4), area * Material.Density, area, Restitution, IsStatic, ShapeType::Polygon, Material);
-		body.Vertices.reserve(4);
-		body.Vertices = CreateBoxVertices(Position, Width, Height);
+		Bodies body = Bodies(Position, 0, 0.5f * std::sqrt(Width * Width + Height * Height), area * Material.Density, area, Restitution, IsStatic, ShapeType::Polygon, Material);
+		body.Vertices = CreateBoxVertices(Width, Height);
 		return body;
 	}
 
@@ -115,33 +115,40 @@ public:
 
 		return vertices;
 	}
-	static std::vector<FlatVector> CreateBoxVertices(FlatVector& Position, float width, float height) {
+	// Vertices are in local space, centered on the body position and counter-clockwise like CreatePolygonVertices
+	static std::vector<FlatVector> CreateBoxVertices(float width, float height) {
 		float halfWidth = width / 2.0f;
 		float halfHeight = height / 2.0f;
 
 		std::vector<FlatVector> vertices(4);
-		vertices[0] = FlatVector(Position.x - halfWidth, Position.y + halfHeight);
-		vertices[1] = FlatVector(Position.x + halfWidth, Position.y + halfHeight);
-		vertices[2] = FlatVector(Position.x + halfWidth, Position.y - halfHeight);
-		vertices[3] = FlatVector(Position.x - halfWidth, Position.y - halfHeight);
+		vertices[0] = FlatVector(-halfWidth, -halfHeight);
+		vertices[1] = FlatVector(halfWidth, -halfHeight);
+		vertices[2] = FlatVector(halfWidth, halfHeight);
+		vertices[3] = FlatVector(-halfWidth, halfHeight);
 
 		return vertices;
 	}
+	// Unit normal of every edge (v[i], v[i + 1]), pointing outwards for counter-clockwise vertices
+	static std::vector<FlatVector> CreateEdgeNormals(const std::vector<FlatVector>& vertices) {
+		std::vector<FlatVector> normals;
+		normals.reserve(vertices.size());
+
+		for (size_t i = 0; i < vertices.size(); i++) {
+			FlatVector edge = vertices[(i + 1) % vertices.size()] - vertices[i];
+			FlatVector normal = FlatVector(edge.y, -edge.x);
+			FlatVector::NormalizedVector(normal);
+			normals.push_back(normal);
+		}
+
+		return normals;
+	}
 
 	void Move(const FlatVector& amount) {
 		Position += amount;
 	}
+	// Vertices stay in local space, the world transform is applied from the rotation by BodyStore
 	void Rotate(float amount) {
-		if (Vertices.size() > 0) {
-			FlatVector center = Position;
-
-			for (auto& vertex : Vertices) {
-				float x = vertex.x - center.x;
-				float y = vertex.y - center.y;
-				vertex.x = center.x + (x * cos(amount) - y * sin(amount));
-				vertex.y = center.y + (x * sin(amount) + y * cos(amount));
-			}
-		}
+		rotation += amount;
 	}
 	void Step(float time, const FlatVector& gravity) {
 		if (IsStatic) return;
@@ -0,0 +1,467 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+
+#include <AABB.h>
+#include <Bodies.h>
+#include <Materials.h>
+#include <ShapeRegistry.h>
+#include <Vector.h>
+
+// Reference to a body that stays valid while removals move the body around the dense arrays. The
+// generation tells a reused slot apart from the body that was removed from it.
+struct BodyHandle {
+	int Slot;
+	uint32_t Generation;
+
+	BodyHandle() : Slot(-1), Generation(0) {}
+	BodyHandle(int Slot, uint32_t Generation) : Slot(Slot), Generation(Generation) {}
+
+	bool IsNull() const {
+		return Slot < 0;
+	}
+	bool operator==(const BodyHandle& other) const {
+		return Slot == other.Slot && Generation == other.Generation;
+	}
+	bool operator!=(const BodyHandle& other) const {
+		return !(*this == other);
+	}
+};
+
+// Friction is copied from the material table entry for the contact solver
+struct BodyMaterial {
+	float Restitution, Density, Mass, Friction;
+	int MaterialId;
+
+	BodyMaterial(float Restitution, float Density, float Mass, float Friction, int MaterialId)
+		: Restitution(Restitution), Density(Density), Mass(Mass), Friction(Friction), MaterialId(MaterialId) {}
+};
+
+// Structure-of-arrays storage for the simulated bodies. The per-step state lives in contiguous
+// hot arrays, which Remove keeps dense by moving the last body into the hole; handle slots are
+// reused through a free list. Shapes and materials are interned in shared tables and referred to by id, each body
+// adding only the scale of its shape.
+class BodyStore {
+public:
+	enum BodyFlags {
+		Static = 1 << 0,
+		Sleeping = 1 << 1,
+		TransformDirty = 1 << 2
+	};
+
+	std::vector<FlatVector> Positions;
+	std::vector<FlatVector> LinearVelocities;
+	std::vector<FlatVector> Forces;
+	std::vector<FlatVector> LiquidDisplacements;
+	std::vector<float> InvMasses;
+	std::vector<float> InvInertias;
+	std::vector<float> Rotations;
+	std::vector<float> RotationalVelocities;
+	std::vector<unsigned char> Flags;
+
+	// Time spent below the sleep velocity and the island a sleeping body was put to sleep with
+	std::vector<float> SleepTimes;
+	std::vector<int> IslandIds;
+
+	// State at the start of the last step, used to interpolate between fixed steps
+	std::vector<FlatVector> PreviousPositions;
+	std::vector<float> PreviousRotations;
+
+	// World-space polygon vertices and edge normals of every body in one flat array each, refreshed
+	// by UpdateWorldShapes for bodies flagged TransformDirty and shared by every pair test the body
+	// takes part in. Body i owns [WorldOffsets[i], WorldOffsets[i + 1]), as many entries as its
+	// shape has vertices, so circles take no room.
+	std::vector<FlatVector> WorldVertexData;
+	std::vector<FlatVector> WorldNormalData;
+	std::vector<int> WorldOffsets = { 0 };
+
+	std::vector<int> ShapeIds;
+	std::vector<float> Scales; // applied to the shared shape's vertices
+	std::vector<float> Radii;  // bounding radius, the circle radius for circles
+	std::vector<BodyMaterial> MaterialData;
+
+	ShapeRegistry SharedShapes;
+	MaterialTable SharedMaterials;
+
+	// Handle slot of every body, stable while the body's index changes
+	std::vector<int> Slots;
+
+	size_t Size() const {
+		return Positions.size();
+	}
+
+	void Reserve(size_t count) {
+		Positions.reserve(count);
+		LinearVelocities.reserve(count);
+		Forces.reserve(count);
+		LiquidDisplacements.reserve(count);
+		InvMasses.reserve(count);
+		InvInertias.reserve(count);
+		Rotations.reserve(count);
+		RotationalVelocities.reserve(count);
+		Flags.reserve(count);
+		SleepTimes.reserve(count);
+		IslandIds.reserve(count);
+		PreviousPositions.reserve(count);
+		PreviousRotations.reserve(count);
+		WorldOffsets.reserve(count + 1);
+		ShapeIds.reserve(count);
+		Scales.reserve(count);
+		Radii.reserve(count);
+		MaterialData.reserve(count);
+		Slots.reserve(count);
+		slotBodies.reserve(count);
+		slotGenerations.reserve(count);
+	}
+
+	BodyHandle Add(const Bodies& body) {
+		int slot = freeSlot;
+		if (slot >= 0) {
+			freeSlot = slotBodies[slot];
+		}
+		else {
+			slot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+		}
+		return AddToSlot(body, slot);
+	}
+
+	// Adds a whole range with one reservation per array, growing at least geometrically so that
+	// repeated small ranges do not reallocate every time. Handles, when given, get one entry per body.
+	void AddRange(const std::vector<Bodies>& bodies, std::vector<BodyHandle>* handles) {
+		Reserve(std::max(Size() + bodies.size(), 2 * Size()));
+		size_t vertexCount = WorldVertexData.size();
+		for (const auto& body : bodies) {
+			vertexCount += GetVertexCount(body);
+		}
+		WorldVertexData.reserve(std::max(vertexCount, 2 * WorldVertexData.size()));
+		WorldNormalData.reserve(WorldVertexData.capacity());
+		if (handles) {
+			handles->reserve(handles->size() + bodies.size());
+		}
+		for (const auto& body : bodies) {
+			BodyHandle handle = Add(body);
+			if (handles) {
+				handles->push_back(handle);
+			}
+		}
+	}
+
+	// Adds a body under a handle taken from ReserveHandle
+	BodyHandle AddReserved(const Bodies& body, const BodyHandle& handle) {
+		return AddToSlot(body, handle.Slot);
+	}
+
+	// Safe on any thread. The handle resolves to no body until AddReserved fills its slot.
+	BodyHandle ReserveHandle() {
+		return BodyHandle(nextSlot.fetch_add(1, std::memory_order_relaxed), 0);
+	}
+
+	// Removes a body in O(1): the last body takes its index and keeps its handle
+	void Remove(int index) {
+		int last = static_cast<int>(Size()) - 1;
+		int slot = Slots[index];
+		slotGenerations[slot]++;
+		slotBodies[slot] = freeSlot;
+		freeSlot = slot;
+		if (index != last) {
+			slotBodies[Slots[last]] = index;
+		}
+
+		SwapRemove(Positions, index);
+		SwapRemove(LinearVelocities, index);
+		SwapRemove(Forces, index);
+		SwapRemove(LiquidDisplacements, index);
+		SwapRemove(InvMasses, index);
+		SwapRemove(InvInertias, index);
+		SwapRemove(Rotations, index);
+		SwapRemove(RotationalVelocities, index);
+		SwapRemove(Flags, index);
+		SwapRemove(SleepTimes, index);
+		SwapRemove(IslandIds, index);
+		SwapRemove(PreviousPositions, index);
+		SwapRemove(PreviousRotations, index);
+		RemoveWorldShape(index, last);
+		SwapRemove(ShapeIds, index);
+		SwapRemove(Scales, index);
+		SwapRemove(Radii, index);
+		SwapRemove(MaterialData, index);
+		SwapRemove(Slots, index);
+		layoutVersion++;
+	}
+
+	// Index of the body, or -1 once it has been removed
+	int GetIndex(const BodyHandle& handle) const {
+		if (handle.Slot < 0 || handle.Slot >= static_cast<int>(slotGenerations.size())) return -1;
+		if (slotGenerations[handle.Slot] != handle.Generation) return -1;
+		return slotBodies[handle.Slot];
+	}
+
+	// Changes whenever a body is added or removed, so state saved under the same version lines up
+	// index for index with the current arrays
+	uint64_t GetLayoutVersion() const {
+		return layoutVersion;
+	}
+
+	BodyHandle GetHandle(int index) const {
+		return BodyHandle(Slots[index], slotGenerations[Slots[index]]);
+	}
+
+	FlatVectorSpan GetWorldVertices(int index) const {
+		return FlatVectorSpan(WorldVertexData.data() + WorldOffsets[index], WorldOffsets[index + 1] - WorldOffsets[index]);
+	}
+	FlatVectorSpan GetWorldNormals(int index) const {
+		return FlatVectorSpan(WorldNormalData.data() + WorldOffsets[index], WorldOffsets[index + 1] - WorldOffsets[index]);
+	}
+
+	const BodyShape& GetShape(int index) const {
+		return SharedShapes.Get(ShapeIds[index]);
+	}
+
+	const Materials& GetMaterial(int index) const {
+		return SharedMaterials.Get(MaterialData[index].MaterialId);
+	}
+
+	float GetArea(int index) const {
+		return GetShape(index).Area * Scales[index] * Scales[index];
+	}
+
+	bool IsStatic(int index) const {
+		return (Flags[index] & BodyFlags::Static) != 0;
+	}
+
+	bool IsSleeping(int index) const {
+		return (Flags[index] & BodyFlags::Sleeping) != 0;
+	}
+
+	// Static or sleeping: neither integrated nor paired with another inactive body
+	bool IsInactive(int index) const {
+		return (Flags[index] & (BodyFlags::Static | BodyFlags::Sleeping)) != 0;
+	}
+
+	void Sleep(int index, int islandId) {
+		Flags[index] |= BodyFlags::Sleeping;
+		IslandIds[index] = islandId;
+		LinearVelocities[index] = FlatVector(0.0f, 0.0f);
+		RotationalVelocities[index] = 0.0f;
+	}
+
+	void Wake(int index) {
+		Flags[index] &= ~BodyFlags::Sleeping;
+		IslandIds[index] = -1;
+		SleepTimes[index] = 0.0f;
+	}
+
+	void Move(int index, const FlatVector& amount) {
+		Positions[index] += amount;
+		Flags[index] |= BodyFlags::TransformDirty;
+	}
+
+	void Rotate(int index, float amount) {
+		Rotations[index] += amount;
+		Flags[index] |= BodyFlags::TransformDirty;
+	}
+
+	// Scales and transforms the shared shape of every body moved or rotated since the last call, with
+	// one sin/cos pair per body. Static and sleeping bodies keep their cached vertices.
+	void UpdateWorldShapes() {
+		size_t count = Size();
+
+		for (size_t i = 0; i < count; i++) {
+			if (!(Flags[i] & BodyFlags::TransformDirty)) continue;
+			Flags[i] &= ~BodyFlags::TransformDirty;
+
+			const BodyShape& shape = GetShape(static_cast<int>(i));
+			if (shape.Type != Bodies::ShapeType::Polygon) continue;
+
+			const FlatVector& position = Positions[i];
+			float scale = Scales[i];
+			float cosine = std::cos(Rotations[i]);
+			float sine = std::sin(Rotations[i]);
+			FlatVector* vertices = WorldVertexData.data() + WorldOffsets[i];
+			FlatVector* normals = WorldNormalData.data() + WorldOffsets[i];
+
+			for (size_t k = 0; k < shape.Vertices.size(); k++) {
+				const FlatVector& v = shape.Vertices[k];
+				const FlatVector& n = shape.Normals[k];
+				vertices[k] = FlatVector(v.x * cosine - v.y * sine, v.x * sine + v.y * cosine) * scale + position;
+				normals[k] = FlatVector(n.x * cosine - n.y * sine, n.x * sine + n.y * cosine);
+			}
+		}
+	}
+
+	void StorePreviousState() {
+		PreviousPositions.assign(Positions.begin(), Positions.end());
+		PreviousRotations.assign(Rotations.begin(), Rotations.end());
+	}
+
+	FlatVector GetInterpolatedPosition(int index, float alpha) const {
+		return PreviousPositions[index] + (Positions[index] - PreviousPositions[index]) * alpha;
+	}
+
+	// Applies gravity, forces and liquid displacement to the velocity of every dynamic body. Positions
+	// follow in IntegratePositions once the contact solver has corrected the velocities. The forces
+	// stay until ClearForces, so each substep of a step applies them again.
+	void IntegrateVelocities(float time, const FlatVector& gravity) {
+		size_t count = Size();
+
+		for (size_t i = 0; i < count; i++) {
+			if (Flags[i] & (BodyFlags::Static | BodyFlags::Sleeping)) continue;
+
+			FlatVector acceleration = (Forces[i] + LiquidDisplacements[i]) * InvMasses[i];
+			acceleration += gravity;
+
+			LinearVelocities[i] += acceleration * time;
+		}
+	}
+
+	// Once all substeps of the step integrated them. Sleeping bodies keep theirs until they wake.
+	void ClearForces() {
+		size_t count = Size();
+
+		for (size_t i = 0; i < count; i++) {
+			if (Flags[i] & (BodyFlags::Static | BodyFlags::Sleeping)) continue;
+
+			LiquidDisplacements[i] = FlatVector(0.0f, 0.0f);
+			Forces[i] = FlatVector(0.0f, 0.0f);
+		}
+	}
+
+	void IntegratePositions(float time) {
+		size_t count = Size();
+
+		for (size_t i = 0; i < count; i++) {
+			if (Flags[i] & (BodyFlags::Static | BodyFlags::Sleeping)) continue;
+
+			Positions[i] += LinearVelocities[i] * time;
+			Rotations[i] += RotationalVelocities[i] * time;
+			Flags[i] |= BodyFlags::TransformDirty;
+		}
+	}
+
+	// Polygons are bounded by their cached world vertices, so UpdateWorldShapes must run first
+	AABB GetAABB(int index) const {
+		const FlatVector& position = Positions[index];
+
+		if (GetShape(index).Type == Bodies::ShapeType::Circle) {
+			float radius = Radii[index];
+			return AABB(position - FlatVector(radius, radius), position + radius);
+		}
+
+		FlatVector min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+		FlatVector max(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+		for (const auto& vertex : GetWorldVertices(index)) {
+			min.x = std::min(min.x, vertex.x);
+			min.y = std::min(min.y, vertex.y);
+			max.x = std::max(max.x, vertex.x);
+			max.y = std::max(max.y, vertex.y);
+		}
+		return AABB(min, max);
+	}
+
+private:
+	std::vector<int> slotBodies; // body index of a used slot, next free slot of a free one, -1 while reserved
+	std::vector<uint32_t> slotGenerations;
+	int freeSlot = -1;
+	std::atomic<int> nextSlot{ 0 }; // first slot never handed out
+	uint64_t layoutVersion = 0;
+
+	BodyHandle AddToSlot(const Bodies& body, int slot) {
+		int index = static_cast<int>(Size());
+		Positions.push_back(body.Position);
+		LinearVelocities.push_back(body.GetlinearVelocity());
+		Forces.push_back(body.force);
+		LiquidDisplacements.push_back(body.LiquidDisplacement);
+		InvMasses.push_back(body.InvMass);
+		int shapeId = InternShape(body);
+		const BodyShape& shape = SharedShapes.Get(shapeId);
+		float scale = body.Vertices.empty() ? body.Radius : 1.0f;
+		float inertia = shape.Inertia * body.Mass * scale * scale;
+		InvInertias.push_back(!body.IsStatic && inertia > 0.0f ? 1.0f / inertia : 0.0f);
+		Rotations.push_back(body.GetRotation());
+		RotationalVelocities.push_back(body.GetRotationalVelocity());
+		Flags.push_back((body.IsStatic ? BodyFlags::Static : 0) | BodyFlags::TransformDirty);
+		SleepTimes.push_back(0.0f);
+		IslandIds.push_back(-1);
+		PreviousPositions.push_back(body.Position);
+		PreviousRotations.push_back(body.GetRotation());
+
+		ShapeIds.push_back(shapeId);
+		Scales.push_back(scale);
+		Radii.push_back(body.Radius);
+		WorldOffsets.push_back(WorldOffsets.back() + static_cast<int>(shape.Vertices.size()));
+		WorldVertexData.resize(WorldOffsets.back());
+		WorldNormalData.resize(WorldOffsets.back());
+		MaterialData.push_back(BodyMaterial(body.Restitution, body.Density, body.Mass, body.Material.Friction, SharedMaterials.Intern(body.Material)));
+
+		if (slot >= static_cast<int>(slotBodies.size())) {
+			slotBodies.resize(slot + 1, -1); // slots in between stay reserved until their bodies arrive
+			slotGenerations.resize(slot + 1, 0);
+		}
+		slotBodies[slot] = index;
+		Slots.push_back(slot);
+		layoutVersion++;
+		return BodyHandle(slot, slotGenerations[slot]);
+	}
+
+	// The last body's vertices take the place of the removed body's, like the other arrays. Only when
+	// the two vertex counts differ do the blocks in between shift and their offsets change.
+	void RemoveWorldShape(int index, int last) {
+		int begin = WorldOffsets[index];
+		int removedCount = WorldOffsets[index + 1] - begin;
+		int lastBegin = WorldOffsets[last];
+		int lastCount = WorldOffsets[last + 1] - lastBegin;
+
+		if (index != last) {
+			if (removedCount == lastCount) {
+				std::copy(WorldVertexData.begin() + lastBegin, WorldVertexData.end(), WorldVertexData.begin() + begin);
+				std::copy(WorldNormalData.begin() + lastBegin, WorldNormalData.end(), WorldNormalData.begin() + begin);
+			}
+			else {
+				MoveBlock(WorldVertexData, begin, removedCount, lastBegin);
+				MoveBlock(WorldNormalData, begin, removedCount, lastBegin);
+				for (int i = index + 1; i <= last; i++) {
+					WorldOffsets[i] += lastCount - removedCount;
+				}
+			}
+		}
+		WorldOffsets.pop_back();
+		WorldVertexData.resize(WorldOffsets.back());
+		WorldNormalData.resize(WorldOffsets.back());
+	}
+
+	// Rotates the trailing block starting at lastBegin to begin and the removed block behind it to the end
+	static void MoveBlock(std::vector<FlatVector>& values, int begin, int removedCount, int lastBegin) {
+		std::rotate(values.begin() + begin, values.begin() + lastBegin, values.end());
+		int lastCount = static_cast<int>(values.size()) - lastBegin;
+		std::rotate(values.begin() + begin + lastCount, values.begin() + begin + lastCount + removedCount, values.end());
+	}
+
+	static size_t GetVertexCount(const Bodies& body) {
+		if (body.Type == Bodies::ShapeType::Circle) return 0;
+		return body.Vertices.empty() ? static_cast<size_t>(body.NumberOfVertices) : body.Vertices.size();
+	}
+
+	// Circles and regular polygons share one unit shape per vertex count, boxes keep their own outline
+	int InternShape(const Bodies& body) {
+		if (body.Type == Bodies::ShapeType::Circle) {
+			return SharedShapes.InternCircle();
+		}
+		if (body.Vertices.empty()) {
+			return SharedShapes.InternRegularPolygon(body.NumberOfVertices);
+		}
+		return SharedShapes.InternPolygon(body.Vertices);
+	}
+
+	template<class T>
+	static void SwapRemove(std::vector<T>& values, int index) {
+		if (index + 1 != static_cast<int>(values.size())) {
+			values[index] = std::move(values.back());
+		}
+		values.pop_back();
+	}
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include <AABB.h>
+#include <Scratch.h>
+
+// Hashed table of uniform grid cells shared by the broad-phase grid and the liquid index. Boxes are
+// registered in every cell they cover, then Build counting-sorts the entries by hash bucket so the
+// entries of a cell lie in one contiguous run. Cells sharing a bucket are told apart by X and Y.
+class CellHashTable {
+public:
+	// A box covering more cells than this is better kept aside and tested against everything
+	static constexpr int MaxCells = 1024;
+
+	struct Entry {
+		int X, Y;
+		int Id;
+
+		Entry() : X(0), Y(0), Id(0) {}
+		Entry(int X, int Y, int Id) : X(X), Y(Y), Id(Id) {}
+	};
+
+	// Cells of far-off finite boxes are clamped to the edge of the grid instead of overflowing int
+	static int CellCoord(float value, float invCellSize) {
+		float cell = std::floor(value * invCellSize);
+		return static_cast<int>(std::max(-CoordLimit, std::min(CoordLimit, cell)));
+	}
+
+	// NaN or infinite boxes cannot be binned and overlap nothing sensible
+	static bool IsFinite(const AABB& box) {
+		return std::isfinite(box.Min.x) && std::isfinite(box.Min.y) && std::isfinite(box.Max.x) && std::isfinite(box.Max.y);
+	}
+
+	static unsigned int Hash(int x, int y) {
+		return static_cast<unsigned int>(x) * 73856093u ^ static_cast<unsigned int>(y) * 19349663u;
+	}
+
+	static int64_t CellCount(const AABB& box, float invCellSize) {
+		int64_t width = static_cast<int64_t>(CellCoord(box.Max.x, invCellSize)) - CellCoord(box.Min.x, invCellSize) + 1;
+		int64_t height = static_cast<int64_t>(CellCoord(box.Max.y, invCellSize)) - CellCoord(box.Min.y, invCellSize) + 1;
+		return width * height;
+	}
+
+	void Clear() {
+		entries.clear();
+	}
+
+	// Room for entryCount entries and the buckets Build makes for them
+	void Reserve(size_t entryCount) {
+		ReserveScratch(entries, entryCount);
+		ReserveScratch(sortedEntries, entryCount);
+		ReserveScratch(bucketStart, 4 * entryCount + 1);
+		ReserveScratch(bucketFill, 4 * entryCount);
+	}
+
+	void Insert(const AABB& box, float invCellSize, int id) {
+		int minX = CellCoord(box.Min.x, invCellSize);
+		int minY = CellCoord(box.Min.y, invCellSize);
+		int maxX = CellCoord(box.Max.x, invCellSize);
+		int maxY = CellCoord(box.Max.y, invCellSize);
+
+		for (int y = minY; y <= maxY; y++) {
+			for (int x = minX; x <= maxX; x++) {
+				entries.push_back(Entry(x, y, id));
+			}
+		}
+	}
+
+	void Build() {
+		size_t tableSize = 1;
+		while (tableSize < entries.size() * 2) tableSize <<= 1;
+		mask = static_cast<unsigned int>(tableSize - 1);
+
+		// Counting sort of the entries by hash bucket
+		bucketStart.assign(tableSize + 1, 0);
+		for (const auto& entry : entries) {
+			bucketStart[(Hash(entry.X, entry.Y) & mask) + 1]++;
+		}
+		for (size_t b = 0; b < tableSize; b++) {
+			bucketStart[b + 1] += bucketStart[b];
+		}
+		bucketFill.assign(bucketStart.begin(), bucketStart.end() - 1);
+		sortedEntries.resize(entries.size());
+		for (const auto& entry : entries) {
+			sortedEntries[bucketFill[Hash(entry.X, entry.Y) & mask]++] = entry;
+		}
+	}
+
+	size_t GetBucketCount() const {
+		return bucketStart.empty() ? 0 : bucketStart.size() - 1;
+	}
+
+	unsigned int GetBucket(int x, int y) const {
+		return Hash(x, y) & mask;
+	}
+
+	// Entries of a bucket, possibly from several cells
+	const Entry* BucketBegin(size_t bucket) const {
+		return sortedEntries.data() + bucketStart[bucket];
+	}
+	const Entry* BucketEnd(size_t bucket) const {
+		return sortedEntries.data() + bucketStart[bucket + 1];
+	}
+
+private:
+	static constexpr float CoordLimit = 1073741824.0f;
+
+	unsigned int mask = 0;
+	std::vector<Entry> entries;
+	std::vector<Entry> sortedEntries;
+	std::vector<int> bucketStart;
+	std::vector<int> bucketFill;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+#include <ContactSolver.h>
+#include <Vector.h>
+
+// Copies a vector of plain values with one memcpy. The destination keeps its capacity, so once it
+// has held as many values the copy does not allocate.
+template<class T>
+inline void CopyPod(std::vector<T>& destination, const std::vector<T>& source) {
+	static_assert(std::is_trivially_copyable<T>::value, "CopyPod needs plain values");
+	destination.resize(source.size());
+	if (!source.empty()) {
+		std::memcpy(destination.data(), source.data(), source.size() * sizeof(T));
+	}
+}
+
+// Dynamic state of the world between two steps. Everything that cannot change while the same bodies
+// exist (shapes, materials, masses, handles and the liquids themselves) stays in the world and is
+// shared by every checkpoint; a checkpoint only records how many liquids there were.
+struct WorldCheckpoint {
+	uint64_t Id = 0;            // 0 while the frame holds no checkpoint
+	uint64_t StepIndex = 0;
+	uint64_t LayoutVersion = 0; // BodyStore::GetLayoutVersion when saved
+	size_t LiquidCount = 0;
+
+	std::vector<FlatVector> Positions;
+	std::vector<FlatVector> LinearVelocities;
+	std::vector<FlatVector> Forces;
+	std::vector<FlatVector> LiquidDisplacements;
+	std::vector<float> Rotations;
+	std::vector<float> RotationalVelocities;
+	std::vector<unsigned char> Flags;
+	std::vector<float> SleepTimes;
+	std::vector<int> IslandIds;
+	std::vector<ContactManifold> Manifolds; // warm-start impulses
+	std::vector<FlatVector> FluidPositions;  // particles of the world's ParticleFluid
+	std::vector<FlatVector> FluidVelocities;
+
+	size_t BodyCount() const {
+		return Positions.size();
+	}
+
+	void Reserve(size_t bodies, size_t manifolds, size_t particles) {
+		Positions.reserve(bodies);
+		LinearVelocities.reserve(bodies);
+		Forces.reserve(bodies);
+		LiquidDisplacements.reserve(bodies);
+		Rotations.reserve(bodies);
+		RotationalVelocities.reserve(bodies);
+		Flags.reserve(bodies);
+		SleepTimes.reserve(bodies);
+		IslandIds.reserve(bodies);
+		Manifolds.reserve(manifolds);
+		FluidPositions.reserve(particles);
+		FluidVelocities.reserve(particles);
+	}
+
+	// Bytes of state held, without the unused capacity
+	size_t GetByteSize() const {
+		return BodyCount() * (4 * sizeof(FlatVector) + 3 * sizeof(float) + sizeof(unsigned char) + sizeof(int))
+			+ Manifolds.size() * sizeof(ContactManifold) + FluidPositions.size() * 2 * sizeof(FlatVector);
+	}
+};
+
+// Fixed number of preallocated checkpoint frames, overwritten oldest first. Checkpoints are numbered
+// from 1 and checkpoint n lives in frame (n - 1) % capacity, so a lookup is O(1) and a checkpoint
+// that was overwritten is simply not found.
+class CheckpointRing {
+public:
+
+	CheckpointRing() : lastId(0) {}
+
+	// Drops all checkpoints. Every frame gets room for bodies, manifolds and particles up front, so
+	// saving a world of that size does not allocate.
+	void SetCapacity(int frameCount, size_t bodies, size_t manifolds, size_t particles) {
+		frames.clear();
+		frames.resize(frameCount > 0 ? frameCount : 0);
+		for (auto& frame : frames) {
+			frame.Reserve(bodies, manifolds, particles);
+		}
+		lastId = 0;
+	}
+
+	int GetCapacity() const {
+		return static_cast<int>(frames.size());
+	}
+
+	void Clear() {
+		for (auto& frame : frames) {
+			frame.Id = 0;
+		}
+	}
+
+	// Frame for the next checkpoint, taking the place of the oldest one
+	WorldCheckpoint& Next() {
+		lastId++;
+		WorldCheckpoint& frame = frames[(lastId - 1) % frames.size()];
+		frame.Id = lastId;
+		return frame;
+	}
+
+	const WorldCheckpoint* Find(uint64_t id) const {
+		if (id == 0 || frames.empty()) return nullptr;
+		const WorldCheckpoint& frame = frames[(id - 1) % frames.size()];
+		return frame.Id == id ? &frame : nullptr;
+	}
+
+	// Newest checkpoint taken after step, or 0
+	uint64_t FindStep(uint64_t step) const {
+		uint64_t id = 0;
+		for (const auto& frame : frames) {
+			if (frame.Id != 0 && frame.StepIndex == step && frame.Id > id) {
+				id = frame.Id;
+			}
+		}
+		return id;
+	}
+
+	uint64_t GetLatestId() const {
+		return lastId;
+	}
+
+private:
+	std::vector<WorldCheckpoint> frames;
+	uint64_t lastId;
+};
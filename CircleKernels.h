@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+
+#include <SatKernels.h>
+#include <Scratch.h>
+#include <Vector.h>
+
+// Circle-circle candidate pairs packed as structure of arrays for CircleKernels::FindOverlaps.
+// The vectors keep their capacity between steps.
+struct CirclePairBatch {
+	std::vector<float> AX, AY, BX, BY;
+	std::vector<float> RadiusSum;
+	std::vector<int> Overlaps;
+
+	int Size() const {
+		return static_cast<int>(AX.size());
+	}
+
+	void Clear() {
+		AX.clear();
+		AY.clear();
+		BX.clear();
+		BY.clear();
+		RadiusSum.clear();
+		Overlaps.clear();
+	}
+
+	// Room for count pairs, so Add and FindOverlaps do not allocate
+	void Reserve(int count) {
+		ReserveScratch(AX, count);
+		ReserveScratch(AY, count);
+		ReserveScratch(BX, count);
+		ReserveScratch(BY, count);
+		ReserveScratch(RadiusSum, count);
+		ReserveScratch(Overlaps, count);
+	}
+
+	void Add(const FlatVector& centerA, const FlatVector& centerB, float radiusSum) {
+		AX.push_back(centerA.x);
+		AY.push_back(centerA.y);
+		BX.push_back(centerB.x);
+		BY.push_back(centerB.y);
+		RadiusSum.push_back(radiusSum);
+	}
+};
+
+// Squared-distance rejection of circle pairs, 8 (SSE) or 16 (AVX) pairs per iteration. Only the
+// surviving pairs need the square root of Intersections::CircleIntersection. Uses the instruction
+// set selected by SatKernels.
+class CircleKernels {
+public:
+
+	// Fills batch.Overlaps with the ascending indices of pairs whose centers are closer than their radius sum
+	static void FindOverlaps(CirclePairBatch& batch) {
+		int count = batch.Size();
+		batch.Overlaps.resize(count);
+
+		int overlapCount;
+		switch (SatKernels::GetLevel()) {
+#ifdef PHYSICS_SAT_X86
+		case SatKernels::Level::AVX: overlapCount = FindOverlapsAvx(batch, count); break;
+		case SatKernels::Level::SSE: overlapCount = FindOverlapsSse(batch, 0, count, 0); break;
+#endif
+		default: overlapCount = FindOverlapsScalar(batch, 0, count, 0); break;
+		}
+
+		batch.Overlaps.resize(overlapCount);
+	}
+
+private:
+	static int FindOverlapsScalar(CirclePairBatch& batch, int begin, int end, int overlapCount) {
+		for (int i = begin; i < end; i++) {
+			float dx = batch.BX[i] - batch.AX[i];
+			float dy = batch.BY[i] - batch.AY[i];
+			if (dx * dx + dy * dy < batch.RadiusSum[i] * batch.RadiusSum[i]) {
+				batch.Overlaps[overlapCount++] = i;
+			}
+		}
+		return overlapCount;
+	}
+
+	static int AppendMask(int* overlaps, int overlapCount, int base, int mask) {
+		for (int bit = 0; mask != 0; bit++, mask >>= 1) {
+			if (mask & 1) overlaps[overlapCount++] = base + bit;
+		}
+		return overlapCount;
+	}
+
+#ifdef PHYSICS_SAT_X86
+	PHYSICS_SAT_TARGET("sse")
+	static int OverlapMaskSse(const CirclePairBatch& batch, int i) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&batch.BX[i]), _mm_loadu_ps(&batch.AX[i]));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&batch.BY[i]), _mm_loadu_ps(&batch.AY[i]));
+		__m128 radiusSum = _mm_loadu_ps(&batch.RadiusSum[i]);
+		__m128 distanceSquared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		return _mm_movemask_ps(_mm_cmplt_ps(distanceSquared, _mm_mul_ps(radiusSum, radiusSum)));
+	}
+
+	PHYSICS_SAT_TARGET("sse")
+	static int FindOverlapsSse(CirclePairBatch& batch, int begin, int end, int overlapCount) {
+		int i = begin;
+		for (; i + 8 <= end; i += 8) {
+			int mask = OverlapMaskSse(batch, i) | (OverlapMaskSse(batch, i + 4) << 4);
+			if (mask != 0) overlapCount = AppendMask(batch.Overlaps.data(), overlapCount, i, mask);
+		}
+		return FindOverlapsScalar(batch, i, end, overlapCount);
+	}
+
+	PHYSICS_SAT_TARGET("avx")
+	static int OverlapMaskAvx(const CirclePairBatch& batch, int i) {
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&batch.BX[i]), _mm256_loadu_ps(&batch.AX[i]));
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&batch.BY[i]), _mm256_loadu_ps(&batch.AY[i]));
+		__m256 radiusSum = _mm256_loadu_ps(&batch.RadiusSum[i]);
+		__m256 distanceSquared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+		return _mm256_movemask_ps(_mm256_cmp_ps(distanceSquared, _mm256_mul_ps(radiusSum, radiusSum), _CMP_LT_OQ));
+	}
+
+	PHYSICS_SAT_TARGET("avx")
+	static int FindOverlapsAvx(CirclePairBatch& batch, int count) {
+		int overlapCount = 0;
+		int i = 0;
+		for (; i + 16 <= count; i += 16) {
+			int mask = OverlapMaskAvx(batch, i) | (OverlapMaskAvx(batch, i + 8) << 8);
+			if (mask != 0) overlapCount = AppendMask(batch.Overlaps.data(), overlapCount, i, mask);
+		}
+		// Remaining pairs in groups of eight, then one by one
+		return FindOverlapsSse(batch, i, count, overlapCount);
+	}
+#endif
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+#include <Bodies.h>
+#include <BodyStore.h>
+#include <Liquids.h>
+#include <Vector.h>
+
+// Change to the world requested from another thread and applied by World::Step
+struct WorldCommand {
+	enum CommandType {
+		AddBody,
+		RemoveBody,
+		SetVelocity,
+		ApplyForce,
+		MoveBody,
+		AddLiquid
+	};
+
+	CommandType Type;
+	BodyHandle Handle;
+	FlatVector Vector;  // velocity, force or displacement
+	float Scalar;       // rotational velocity
+	std::optional<Bodies> Body;
+	std::optional<Liquids> Liquid;
+
+	WorldCommand() : Type(CommandType::AddBody), Scalar(0.0f) {}
+};
+
+// Unbounded multi-producer single-consumer queue (intrusive linked list after D. Vyukov). Push is
+// one atomic exchange and never waits for other producers or the consumer. A node pushed while Pop
+// runs may be taken by the next Pop instead.
+template <typename T>
+class MpscQueue {
+public:
+
+	MpscQueue() : head(&stub), tail(&stub) {
+		stub.Next.store(nullptr, std::memory_order_relaxed);
+	}
+
+	~MpscQueue() {
+		while (Pop([](T&) {})) {}
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	// Any thread
+	void Push(T value) {
+		PushNode(new Node(std::move(value)));
+	}
+
+	// Consumer thread only. Hands the oldest value to consume, or returns false when the queue is
+	// empty or the next push is still in flight.
+	template <typename Consumer>
+	bool Pop(Consumer&& consume) {
+		Node* first = tail;
+		Node* next = first->Next.load(std::memory_order_acquire);
+		if (first == &stub) {
+			if (next == nullptr) return false;
+			tail = next;
+			first = next;
+			next = next->Next.load(std::memory_order_acquire);
+		}
+		if (next == nullptr) {
+			if (first != head.load(std::memory_order_acquire)) return false;
+			PushNode(&stub);
+			next = first->Next.load(std::memory_order_acquire);
+			if (next == nullptr) return false;
+		}
+
+		tail = next;
+		consume(first->Value);
+		delete first;
+		return true;
+	}
+
+private:
+	struct Node {
+		std::atomic<Node*> Next;
+		T Value;
+
+		Node() : Next(nullptr) {}
+		explicit Node(T&& Value) : Next(nullptr), Value(std::move(Value)) {}
+	};
+
+	Node stub;
+	std::atomic<Node*> head; // last pushed node, written by producers
+	Node* tail;              // next node to pop, owned by the consumer
+
+	void PushNode(Node* node) {
+		node->Next.store(nullptr, std::memory_order_relaxed);
+		Node* previous = head.exchange(node, std::memory_order_acq_rel);
+		previous->Next.store(node, std::memory_order_release);
+	}
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+#include <Vector.h>
+
+// Result of the narrow-phase for one touching pair of bodies
+struct Contact {
+	int A, B;
+	FlatVector Normal;
+	float Depth;
+	FlatVector Point0, Point1;
+	float Depth0, Depth1; // penetration at each contact point
+	int PointCount;
+	// Body whose edge clipped the points, A or B, or -1 when they were not clipped. The features name
+	// the reference edge, incident edge and vertex or side plane each point came from.
+	int Reference;
+	uint32_t Feature0, Feature1;
+
+	Contact() : A(0), B(0), Depth(0.0f), Depth0(0.0f), Depth1(0.0f), PointCount(0), Reference(-1), Feature0(0), Feature1(0) {}
+};
@@ -0,0 +1,473 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <BodyStore.h>
+#include <Contact.h>
+#include <Scratch.h>
+#include <Vector.h>
+
+// Contact point of a manifold together with the impulses accumulated while it persisted
+struct ManifoldPoint {
+	FlatVector Position;
+	FlatVector RA, RB; // from the body positions to the contact point
+	float Depth; // at the start of the step
+	float NormalMass, TangentMass;
+	float Bias; // separating speed restitution asks for
+	float PositionBias; // separating speed that removes the penetration beyond the allowance
+	float NormalImpulse, TangentImpulse;
+	uint32_t Feature; // clip feature the point came from, the same while the point persists
+
+	ManifoldPoint() : Depth(0.0f), NormalMass(0.0f), TangentMass(0.0f), Bias(0.0f), PositionBias(0.0f), NormalImpulse(0.0f), TangentImpulse(0.0f),
+		Feature(0) {}
+};
+
+struct ContactManifold {
+	uint64_t Key;
+	int A, B;
+	int SlotA; // handle slot of A, tells whether a removal swapped the order of the pair
+	int ReferenceSlot; // handle slot of the body whose edge clipped the points, -1 if they were not clipped
+	FlatVector Normal;
+	float Friction, Restitution;
+	int PointCount;
+	ManifoldPoint Points[2];
+	bool BlockSolve; // two points whose normal impulses are solved together
+	float K11, K12, K22, InvK11, InvK12, InvK22; // normal mass matrix of the two points and its inverse
+
+	ContactManifold() : Key(0), A(0), B(0), SlotA(-1), ReferenceSlot(-1), Friction(0.0f), Restitution(0.0f), PointCount(0), BlockSolve(false),
+		K11(0.0f), K12(0.0f), K22(0.0f), InvK11(0.0f), InvK12(0.0f), InvK22(0.0f) {}
+};
+
+// Sequential-impulse solver over the contacts of one step. Manifolds are cached by the handle slots
+// of the body pair, so the normal and friction impulses of a contact that persists warm-start the
+// next step, even after a removal moved one of the bodies, and a resting stack needs only a few
+// iterations. A point continues a cached one when both were clipped against the same reference
+// body and came from the same clip feature, however far the bodies moved in between.
+//
+// The step is split into substeps that share its contacts. The iterations are spread over them, so
+// a substep costs no more than the iterations it runs, while gravity and the contact response
+// alternate in smaller increments and a tall column no longer leans over.
+class ContactSolver {
+public:
+
+	ContactSolver(int Iterations = 8, int Substeps = 4) : Iterations(Iterations), Substeps(Substeps), WarmStarting(true) {}
+
+	void SetIterations(int iterations) {
+		Iterations = std::max(1, iterations);
+	}
+	int GetIterations() const {
+		return Iterations;
+	}
+	void SetSubsteps(int substeps) {
+		Substeps = std::max(1, substeps);
+	}
+	int GetSubsteps() const {
+		return Substeps;
+	}
+	// Substeps a step runs, never more than the iterations, since each substep runs at least one
+	int GetSubstepCount() const {
+		return std::min(Substeps, Iterations);
+	}
+	void SetWarmStarting(bool enabled) {
+		WarmStarting = enabled;
+	}
+	bool IsWarmStarting() const {
+		return WarmStarting;
+	}
+	size_t GetManifoldCount() const {
+		return cachedManifolds.size();
+	}
+	// Room for contactCount manifolds and the push velocities of bodyCount bodies
+	void Reserve(size_t contactCount, size_t bodyCount) {
+		ReserveScratch(manifolds, contactCount);
+		ReserveScratch(cachedManifolds, contactCount);
+		ReserveScratch(pushLinearVelocities, bodyCount);
+		ReserveScratch(pushRotationalVelocities, bodyCount);
+	}
+	// Forgets the accumulated impulses
+	void Clear() {
+		cachedManifolds.clear();
+	}
+	// Manifolds kept for warm starting, sorted by key. Restoring them brings back the impulses a
+	// checkpoint was taken with; the body indices must still refer to the same bodies.
+	const std::vector<ContactManifold>& GetCachedManifolds() const {
+		return cachedManifolds;
+	}
+	void SetCachedManifolds(const std::vector<ContactManifold>& manifolds) {
+		cachedManifolds.assign(manifolds.begin(), manifolds.end());
+	}
+
+	// Which body of the pair clipped last step's points, 0 for a and 1 for b, or -1 when the pair was
+	// not touching or not clipped. The narrow phase keeps that body as the reference.
+	int GetPreferredReference(const BodyStore& store, int a, int b) const {
+		int slotA = store.Slots[a];
+		int slotB = store.Slots[b];
+		const ContactManifold* cached = FindCached(PairKey(std::min(slotA, slotB), std::max(slotA, slotB)));
+		if (!cached || cached->ReferenceSlot < 0) return -1;
+		return cached->ReferenceSlot == slotA ? 0 : 1;
+	}
+
+	// Builds the manifolds of the step's contacts, which were found at the positions store keeps as
+	// the previous state, and takes over the impulses of the cached ones
+	void BeginStep(const BodyStore& store, const std::vector<Contact>& contacts) {
+		BuildManifolds(store, contacts);
+	}
+
+	// Corrects the velocities, then pushes overlapping bodies apart. The push moves positions directly
+	// instead of adding to the velocities, so a stack settling into its allowed penetration does not
+	// gain speed from it and bounce. Gravity of the substep must already be in the velocities.
+	void SolveSubstep(BodyStore& store, int substep, float substepTime) {
+		int substeps = GetSubstepCount();
+		int iterations = Iterations / substeps + (substep < Iterations % substeps ? 1 : 0);
+		float invSubstepTime = substepTime > 0.0f ? 1.0f / substepTime : 0.0f;
+
+		// Restitution needs the approach speeds before any impulse of this step was applied
+		if (substep == 0) {
+			for (auto& manifold : manifolds) {
+				PreStep(store, manifold);
+			}
+		}
+		for (auto& manifold : manifolds) {
+			UpdateDepths(store, manifold, invSubstepTime);
+			ApplyCachedImpulses(store, manifold);
+		}
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			for (auto& manifold : manifolds) {
+				ApplyImpulses(store, manifold);
+			}
+		}
+		CorrectPositions(store, substepTime);
+	}
+
+	// Keeps the impulses of the last substep for warm-starting the next step
+	void EndStep() {
+		std::sort(manifolds.begin(), manifolds.end(), [](const ContactManifold& a, const ContactManifold& b) { return a.Key < b.Key; });
+		cachedManifolds.swap(manifolds);
+	}
+
+private:
+	static constexpr float BiasFactor = 0.2f;
+	static constexpr float AllowedPenetration = 0.01f;
+	static constexpr float RestitutionThreshold = 1.0f; // slower approaches do not bounce
+	static constexpr float MaxConditionNumber = 1000.0f;
+
+	int Iterations;
+	int Substeps;
+	bool WarmStarting;
+	std::vector<ContactManifold> manifolds;
+	std::vector<ContactManifold> cachedManifolds; // last step's manifolds, sorted by key
+	std::vector<FlatVector> pushLinearVelocities; // per body, only moved the positions by
+	std::vector<float> pushRotationalVelocities;
+
+	static uint64_t PairKey(int a, int b) {
+		return (static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32) | static_cast<uint32_t>(b);
+	}
+
+	static float Cross(const FlatVector& a, const FlatVector& b) {
+		return a.x * b.y - a.y * b.x;
+	}
+	static FlatVector Cross(float w, const FlatVector& r) {
+		return FlatVector(-w * r.y, w * r.x);
+	}
+
+	void BuildManifolds(const BodyStore& store, const std::vector<Contact>& contacts) {
+		ReserveScratch(manifolds, contacts.size());
+		manifolds.resize(contacts.size());
+
+		for (size_t c = 0; c < contacts.size(); c++) {
+			const Contact& contact = contacts[c];
+			ContactManifold& manifold = manifolds[c];
+
+			int slotA = store.Slots[contact.A];
+			int slotB = store.Slots[contact.B];
+			manifold.Key = PairKey(std::min(slotA, slotB), std::max(slotA, slotB));
+			manifold.A = contact.A;
+			manifold.B = contact.B;
+			manifold.SlotA = slotA;
+			manifold.ReferenceSlot = contact.Reference >= 0 ? store.Slots[contact.Reference] : -1;
+			manifold.Normal = contact.Normal;
+			manifold.Friction = std::sqrt(store.MaterialData[contact.A].Friction * store.MaterialData[contact.B].Friction);
+			manifold.Restitution = std::min(store.MaterialData[contact.A].Restitution, store.MaterialData[contact.B].Restitution);
+			manifold.PointCount = std::max(1, std::min(2, contact.PointCount));
+
+			const FlatVector* positions[2] = { &contact.Point0, &contact.Point1 };
+			const float depths[2] = { contact.Depth0, contact.Depth1 };
+			const uint32_t features[2] = { contact.Feature0, contact.Feature1 };
+			for (int p = 0; p < manifold.PointCount; p++) {
+				manifold.Points[p] = ManifoldPoint();
+				manifold.Points[p].Position = contact.PointCount > 0 ? *positions[p] : store.Positions[contact.A];
+				manifold.Points[p].Depth = contact.PointCount > 0 ? depths[p] : contact.Depth;
+				manifold.Points[p].Feature = features[p];
+			}
+
+			if (WarmStarting) {
+				WarmStartFromCache(manifold);
+			}
+		}
+	}
+
+	const ContactManifold* FindCached(uint64_t key) const {
+		auto cached = std::lower_bound(cachedManifolds.begin(), cachedManifolds.end(), key,
+			[](const ContactManifold& m, uint64_t key) { return m.Key < key; });
+		if (cached == cachedManifolds.end() || cached->Key != key) return nullptr;
+		return &*cached;
+	}
+
+	void WarmStartFromCache(ContactManifold& manifold) const {
+		const ContactManifold* cached = FindCached(manifold.Key);
+		if (!cached || cached->ReferenceSlot != manifold.ReferenceSlot) return;
+
+		// With the bodies swapped the normal and tangent flip, and the same impulses apply unchanged
+		float orientation = cached->SlotA == manifold.SlotA ? 1.0f : -1.0f;
+		if (orientation * FlatVector::Dot(cached->Normal, manifold.Normal) < 0.95f) return;
+
+		for (int p = 0; p < manifold.PointCount; p++) {
+			ManifoldPoint& point = manifold.Points[p];
+
+			for (int q = 0; q < cached->PointCount; q++) {
+				if (cached->Points[q].Feature == point.Feature) {
+					point.NormalImpulse = cached->Points[q].NormalImpulse;
+					point.TangentImpulse = cached->Points[q].TangentImpulse;
+					break;
+				}
+			}
+		}
+	}
+
+	void PreStep(BodyStore& store, ContactManifold& manifold) {
+		int a = manifold.A;
+		int b = manifold.B;
+		float invMassA = store.InvMasses[a], invMassB = store.InvMasses[b];
+		float invInertiaA = store.InvInertias[a], invInertiaB = store.InvInertias[b];
+		const FlatVector& normal = manifold.Normal;
+		FlatVector tangent(normal.y, -normal.x);
+
+		for (int p = 0; p < manifold.PointCount; p++) {
+			ManifoldPoint& point = manifold.Points[p];
+			point.RA = point.Position - store.Positions[a];
+			point.RB = point.Position - store.Positions[b];
+
+			float rnA = FlatVector::Dot(point.RA, normal), rnB = FlatVector::Dot(point.RB, normal);
+			float kNormal = invMassA + invMassB
+				+ invInertiaA * (FlatVector::Dot(point.RA, point.RA) - rnA * rnA)
+				+ invInertiaB * (FlatVector::Dot(point.RB, point.RB) - rnB * rnB);
+			point.NormalMass = kNormal > 0.0f ? 1.0f / kNormal : 0.0f;
+
+			float rtA = FlatVector::Dot(point.RA, tangent), rtB = FlatVector::Dot(point.RB, tangent);
+			float kTangent = invMassA + invMassB
+				+ invInertiaA * (FlatVector::Dot(point.RA, point.RA) - rtA * rtA)
+				+ invInertiaB * (FlatVector::Dot(point.RB, point.RB) - rtB * rtB);
+			point.TangentMass = kTangent > 0.0f ? 1.0f / kTangent : 0.0f;
+
+			float approach = FlatVector::Dot(RelativeVelocity(store, a, b, point), normal);
+			point.Bias = approach < -RestitutionThreshold ? -manifold.Restitution * approach : 0.0f;
+		}
+
+		manifold.BlockSolve = false;
+		if (manifold.PointCount == 2) {
+			const ManifoldPoint& point1 = manifold.Points[0];
+			const ManifoldPoint& point2 = manifold.Points[1];
+			float rn1A = Cross(point1.RA, normal), rn1B = Cross(point1.RB, normal);
+			float rn2A = Cross(point2.RA, normal), rn2B = Cross(point2.RB, normal);
+			float k11 = invMassA + invMassB + invInertiaA * rn1A * rn1A + invInertiaB * rn1B * rn1B;
+			float k22 = invMassA + invMassB + invInertiaA * rn2A * rn2A + invInertiaB * rn2B * rn2B;
+			float k12 = invMassA + invMassB + invInertiaA * rn1A * rn2A + invInertiaB * rn1B * rn2B;
+			float determinant = k11 * k22 - k12 * k12;
+			if (k11 * k11 < MaxConditionNumber * determinant) {
+				manifold.BlockSolve = true;
+				manifold.K11 = k11;
+				manifold.K12 = k12;
+				manifold.K22 = k22;
+				manifold.InvK11 = k22 / determinant;
+				manifold.InvK12 = -k12 / determinant;
+				manifold.InvK22 = k11 / determinant;
+			}
+		}
+	}
+
+	// The points keep the arms they were found with, and their depths follow how far the bodies
+	// moved along the normal since the step began
+	void UpdateDepths(const BodyStore& store, ContactManifold& manifold, float invSubstepTime) {
+		int a = manifold.A;
+		int b = manifold.B;
+
+		for (int p = 0; p < manifold.PointCount; p++) {
+			ManifoldPoint& point = manifold.Points[p];
+			FlatVector movedA = store.Positions[a] - store.PreviousPositions[a] + Cross(store.Rotations[a] - store.PreviousRotations[a], point.RA);
+			FlatVector movedB = store.Positions[b] - store.PreviousPositions[b] + Cross(store.Rotations[b] - store.PreviousRotations[b], point.RB);
+			float depth = point.Depth - FlatVector::Dot(movedB - movedA, manifold.Normal);
+			point.PositionBias = BiasFactor * invSubstepTime * std::max(0.0f, depth - AllowedPenetration);
+		}
+	}
+
+	void ApplyCachedImpulses(BodyStore& store, ContactManifold& manifold) {
+		const FlatVector& normal = manifold.Normal;
+		FlatVector tangent(normal.y, -normal.x);
+
+		for (int p = 0; p < manifold.PointCount; p++) {
+			const ManifoldPoint& point = manifold.Points[p];
+			ApplyImpulse(store, manifold.A, manifold.B, point, normal * point.NormalImpulse + tangent * point.TangentImpulse);
+		}
+	}
+
+	void ApplyImpulses(BodyStore& store, ContactManifold& manifold) {
+		int a = manifold.A;
+		int b = manifold.B;
+		const FlatVector& normal = manifold.Normal;
+		FlatVector tangent(normal.y, -normal.x);
+
+		// Friction of every point first, bounded by the normal impulses of the last iteration, so that
+		// the points of a manifold do not each see the rotation left by the other's normal impulse and
+		// accumulate opposite friction
+		for (int p = 0; p < manifold.PointCount; p++) {
+			ManifoldPoint& point = manifold.Points[p];
+
+			float tangentVelocity = FlatVector::Dot(RelativeVelocity(store, a, b, point), tangent);
+			float tangentImpulse = -point.TangentMass * tangentVelocity;
+
+			float maxFriction = manifold.Friction * point.NormalImpulse;
+			float previousTangent = point.TangentImpulse;
+			point.TangentImpulse = std::max(-maxFriction, std::min(previousTangent + tangentImpulse, maxFriction));
+			ApplyImpulse(store, a, b, point, tangent * (point.TangentImpulse - previousTangent));
+		}
+
+		if (manifold.PointCount == 2 && manifold.BlockSolve) {
+			SolveNormalBlock(store, manifold);
+			return;
+		}
+
+		for (int p = 0; p < manifold.PointCount; p++) {
+			ManifoldPoint& point = manifold.Points[p];
+
+			float normalVelocity = FlatVector::Dot(RelativeVelocity(store, a, b, point), normal);
+			float normalImpulse = point.NormalMass * (point.Bias - normalVelocity);
+
+			// Clamp the accumulated impulse, not the increment, so warm-started contacts can relax
+			float previousNormal = point.NormalImpulse;
+			point.NormalImpulse = std::max(previousNormal + normalImpulse, 0.0f);
+			ApplyImpulse(store, a, b, point, normal * (point.NormalImpulse - previousNormal));
+		}
+	}
+
+	void SolveNormalBlock(BodyStore& store, ContactManifold& manifold) {
+		int a = manifold.A;
+		int b = manifold.B;
+		const FlatVector& normal = manifold.Normal;
+		ManifoldPoint& point1 = manifold.Points[0];
+		ManifoldPoint& point2 = manifold.Points[1];
+
+		float old1 = point1.NormalImpulse, old2 = point2.NormalImpulse;
+		float b1 = FlatVector::Dot(RelativeVelocity(store, a, b, point1), normal) - point1.Bias;
+		float b2 = FlatVector::Dot(RelativeVelocity(store, a, b, point2), normal) - point2.Bias;
+		float x1, x2;
+		if (!SolveBlock(manifold, old1, old2, b1, b2, x1, x2)) return;
+
+		point1.NormalImpulse = x1;
+		point2.NormalImpulse = x2;
+		ApplyImpulse(store, a, b, point1, normal * (x1 - old1));
+		ApplyImpulse(store, a, b, point2, normal * (x2 - old2));
+	}
+
+	// Accumulated normal impulses x1, x2 of both points of a manifold that leave neither approaching,
+	// found by trying which of the points stay active. b1 and b2 are the approach speeds at the points
+	// still under the accumulated impulses old1, old2. False when no case fits.
+	static bool SolveBlock(const ContactManifold& manifold, float old1, float old2, float b1, float b2, float& x1, float& x2) {
+		b1 -= manifold.K11 * old1 + manifold.K12 * old2;
+		b2 -= manifold.K12 * old1 + manifold.K22 * old2;
+
+		x1 = -(manifold.InvK11 * b1 + manifold.InvK12 * b2);
+		x2 = -(manifold.InvK12 * b1 + manifold.InvK22 * b2);
+		if (x1 >= 0.0f && x2 >= 0.0f) return true;
+
+		x1 = -b1 / manifold.K11;
+		x2 = 0.0f;
+		if (x1 >= 0.0f && manifold.K12 * x1 + b2 >= 0.0f) return true;
+
+		x1 = 0.0f;
+		x2 = -b2 / manifold.K22;
+		if (x2 >= 0.0f && manifold.K12 * x2 + b1 >= 0.0f) return true;
+
+		x1 = 0.0f;
+		x2 = 0.0f;
+		return b1 >= 0.0f && b2 >= 0.0f;
+	}
+
+	// Split impulses: the push of every point accumulates in velocities of its own, which move the
+	// positions once and are then forgotten. They are zero again afterwards, so only a change in the
+	// body count clears them. Every substep starts again from the depths left by the last, so one
+	// pass over the manifolds is enough.
+	void CorrectPositions(BodyStore& store, float substepTime) {
+		size_t count = store.Size();
+		if (pushLinearVelocities.size() != count) {
+			ReserveScratch(pushLinearVelocities, count);
+			ReserveScratch(pushRotationalVelocities, count);
+			pushLinearVelocities.assign(count, FlatVector(0.0f, 0.0f));
+			pushRotationalVelocities.assign(count, 0.0f);
+		}
+
+		for (auto& manifold : manifolds) {
+			int a = manifold.A;
+			int b = manifold.B;
+			const FlatVector& normal = manifold.Normal;
+
+			if (manifold.PointCount == 2 && manifold.BlockSolve) {
+				const ManifoldPoint& point1 = manifold.Points[0];
+				const ManifoldPoint& point2 = manifold.Points[1];
+				float b1 = FlatVector::Dot(PushVelocity(a, b, point1), normal) - point1.PositionBias;
+				float b2 = FlatVector::Dot(PushVelocity(a, b, point2), normal) - point2.PositionBias;
+
+				float x1, x2;
+				if (!SolveBlock(manifold, 0.0f, 0.0f, b1, b2, x1, x2)) continue;
+
+				ApplyPush(store, a, b, point1, normal * x1);
+				ApplyPush(store, a, b, point2, normal * x2);
+				continue;
+			}
+
+			for (int p = 0; p < manifold.PointCount; p++) {
+				const ManifoldPoint& point = manifold.Points[p];
+
+				float pushImpulse = point.NormalMass * (point.PositionBias - FlatVector::Dot(PushVelocity(a, b, point), normal));
+				ApplyPush(store, a, b, point, normal * std::max(pushImpulse, 0.0f));
+			}
+		}
+
+		for (const auto& manifold : manifolds) {
+			for (int body : { manifold.A, manifold.B }) {
+				if (store.InvMasses[body] == 0.0f) continue;
+
+				store.Positions[body] += pushLinearVelocities[body] * substepTime;
+				store.Rotations[body] += pushRotationalVelocities[body] * substepTime;
+				pushLinearVelocities[body] = FlatVector(0.0f, 0.0f);
+				pushRotationalVelocities[body] = 0.0f;
+			}
+		}
+	}
+
+	FlatVector PushVelocity(int a, int b, const ManifoldPoint& point) const {
+		return pushLinearVelocities[b] + Cross(pushRotationalVelocities[b], point.RB)
+			- pushLinearVelocities[a] - Cross(pushRotationalVelocities[a], point.RA);
+	}
+
+	void ApplyPush(const BodyStore& store, int a, int b, const ManifoldPoint& point, const FlatVector& impulse) {
+		pushLinearVelocities[a] -= impulse * store.InvMasses[a];
+		pushRotationalVelocities[a] -= store.InvInertias[a] * Cross(point.RA, impulse);
+		pushLinearVelocities[b] += impulse * store.InvMasses[b];
+		pushRotationalVelocities[b] += store.InvInertias[b] * Cross(point.RB, impulse);
+	}
+
+	static FlatVector RelativeVelocity(const BodyStore& store, int a, int b, const ManifoldPoint& point) {
+		return store.LinearVelocities[b] + Cross(store.RotationalVelocities[b], point.RB)
+			- store.LinearVelocities[a] - Cross(store.RotationalVelocities[a], point.RA);
+	}
+
+	static void ApplyImpulse(BodyStore& store, int a, int b, const ManifoldPoint& point, const FlatVector& impulse) {
+		store.LinearVelocities[a] -= impulse * store.InvMasses[a];
+		store.RotationalVelocities[a] -= store.InvInertias[a] * Cross(point.RA, impulse);
+		store.LinearVelocities[b] += impulse * store.InvMasses[b];
+		store.RotationalVelocities[b] += store.InvInertias[b] * Cross(point.RB, impulse);
+	}
+};
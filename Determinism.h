@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+
+// Strict float settings for builds that define PHYSICS_DETERMINISTIC. Every expression must round the
+// same way wherever it is evaluated, so a pair tested by the SIMD kernels of one worker and by the
+// scalar tail of another gives the same bits: no fast-math reassociation, no x87 excess precision and
+// no contraction of a * b + c into a fused multiply-add.
+#ifdef PHYSICS_DETERMINISTIC
+#if defined(__FAST_MATH__)
+#error "PHYSICS_DETERMINISTIC cannot be combined with -ffast-math"
+#endif
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+#error "PHYSICS_DETERMINISTIC needs floats evaluated in float precision (SSE2 instead of x87)"
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma float_control(precise, on)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__) && defined(__FP_FAST_FMAF) && !defined(PHYSICS_FP_CONTRACT_OFF)
+// GCC contracts C++ by default once the target has FMA and has no pragma to turn it off. With -O3 and
+// a native -march its vectorizer can still split loops by alignment, so add -fno-tree-vectorize there.
+#error "PHYSICS_DETERMINISTIC with FMA needs -ffp-contract=off (then define PHYSICS_FP_CONTRACT_OFF)"
+#endif
+#endif
+
+// FNV-1a over raw bytes, for comparing simulation state across runs and machines
+inline uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+static const uint64_t HashSeed = 14695981039346656037ull;
@@ -0,0 +1,586 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+
+#include <AABB.h>
+#include <Scratch.h>
+
+// Incremental bounding volume hierarchy broad-phase. Every dynamic body owns a leaf with a
+// fattened box, and a leaf is only reinserted once the body leaves it. Overlapping pairs are kept
+// between steps, so only bodies that were reinserted have to query the tree again.
+// Bodies flagged inactive (static or sleeping) are never refitted and pairs of two of them are skipped.
+class DynamicTree {
+public:
+
+	DynamicTree(float FatMargin = 0.1f) : FatMargin(FatMargin), root(NullNode), freeList(NullNode), refitInactive(false) {}
+
+	void SetFatMargin(float margin) {
+		FatMargin = margin;
+	}
+
+	int GetHeight() const {
+		return root == NullNode ? 0 : nodes[root].Height;
+	}
+	// Room for the leaves of bodyCount bodies and pairCount overlapping pairs
+	void Reserve(size_t bodyCount, size_t pairCount) {
+		ReserveScratch(nodes, 2 * bodyCount);
+		ReserveScratch(bodyProxies, bodyCount);
+		ReserveScratch(movedBodies, bodyCount);
+		ReserveScratch(queryStack, bodyCount);
+		ReserveScratch(trackedPairs, pairCount);
+		ReserveScratch(newPairs, pairCount);
+		ReserveScratch(mergedPairs, pairCount);
+	}
+
+	// Number of leaves inserted or reinserted one by one during the last FindPairs call
+	size_t GetMovedCount() const {
+		return movedBodies.size();
+	}
+
+	// Follows BodyStore::Remove: the leaf of index is destroyed and the last body takes its index.
+	// Pairs of both indices are dropped and queried again on the next call.
+	void RemoveBody(int index, int last) {
+		int trackedCount = static_cast<int>(bodyProxies.size());
+		if (index >= trackedCount) return; // neither body has a leaf yet
+
+		if (bodyProxies[index] != NullNode) { // a body moved in by an earlier removal may still wait for its leaf
+			DestroyProxy(bodyProxies[index]);
+		}
+		staleBodies.push_back(index);
+		if (last >= trackedCount) {
+			bodyProxies[index] = NullNode; // the moved body gets its leaf on the next call
+			return;
+		}
+		if (last != index) {
+			bodyProxies[index] = bodyProxies[last];
+			if (bodyProxies[index] != NullNode) {
+				nodes[bodyProxies[index]].Body = index;
+			}
+			staleBodies.push_back(last);
+		}
+		bodyProxies.pop_back();
+	}
+
+	// Makes the next FindPairs check the leaves of static and sleeping bodies too, after their
+	// positions were changed behind the tree's back
+	void RefitAll() {
+		refitInactive = true;
+	}
+
+	void FindPairs(const std::vector<AABB>& boxes, const std::vector<unsigned char>& inactive, std::vector<BodyPair>& pairs) {
+		int bodyCount = static_cast<int>(boxes.size());
+		movedBodies.clear();
+
+		if (static_cast<int>(bodyProxies.size()) > bodyCount) {
+			while (static_cast<int>(bodyProxies.size()) > bodyCount) {
+				if (bodyProxies.back() != NullNode) DestroyProxy(bodyProxies.back());
+				bodyProxies.pop_back();
+			}
+			trackedPairs.erase(std::remove_if(trackedPairs.begin(), trackedPairs.end(),
+				[bodyCount](const BodyPair& pair) { return pair.B >= bodyCount; }), trackedPairs.end());
+		}
+		if (!staleBodies.empty()) {
+			DropStalePairs();
+		}
+
+		for (int i = 0; i < static_cast<int>(bodyProxies.size()); i++) {
+			if (bodyProxies[i] == NullNode) {
+				bodyProxies[i] = CreateProxy(boxes[i], i);
+				movedBodies.push_back(i);
+				continue;
+			}
+			if (inactive[i] && !refitInactive) continue; // static and sleeping bodies never leave their box
+
+			if (!nodes[bodyProxies[i]].Box.Contains(boxes[i])) {
+				RemoveLeaf(bodyProxies[i]);
+				nodes[bodyProxies[i]].Box = boxes[i].Fattened(FatMargin);
+				InsertLeaf(bodyProxies[i]);
+				movedBodies.push_back(i);
+			}
+		}
+		int firstNew = static_cast<int>(bodyProxies.size());
+		bool rebuilt = bodyCount - firstNew >= std::max(firstNew, BuildThreshold);
+		if (rebuilt) {
+			Rebuild(boxes, firstNew);
+		}
+		else {
+			for (int i = firstNew; i < bodyCount; i++) {
+				bodyProxies.push_back(CreateProxy(boxes[i], i));
+				movedBodies.push_back(i);
+			}
+		}
+		refitInactive = false;
+
+		if (!movedBodies.empty() || rebuilt) {
+			// Pairs whose fat boxes separated can only involve a reinserted leaf
+			trackedPairs.erase(std::remove_if(trackedPairs.begin(), trackedPairs.end(),
+				[this](const BodyPair& pair) {
+					return !AABB::Overlap(nodes[bodyProxies[pair.A]].Box, nodes[bodyProxies[pair.B]].Box);
+				}), trackedPairs.end());
+
+			newPairs.clear();
+			for (int body : movedBodies) {
+				Query(nodes[bodyProxies[body]].Box, body, inactive);
+			}
+			if (rebuilt) {
+				QueryNewBodies(firstNew, inactive);
+			}
+			std::sort(newPairs.begin(), newPairs.end(), PairLess);
+			newPairs.erase(std::unique(newPairs.begin(), newPairs.end(), PairEqual), newPairs.end());
+
+			mergedPairs.clear();
+			std::set_union(trackedPairs.begin(), trackedPairs.end(), newPairs.begin(), newPairs.end(),
+				std::back_inserter(mergedPairs), PairLess);
+			trackedPairs.swap(mergedPairs);
+		}
+
+		pairs.clear();
+		for (const auto& pair : trackedPairs) {
+			if (!(inactive[pair.A] && inactive[pair.B])) {
+				pairs.push_back(pair);
+			}
+		}
+	}
+
+private:
+	static const int NullNode = -1;
+	static constexpr int BuildThreshold = 64; // fewer new bodies than this are always inserted one by one
+
+	struct Node {
+		AABB Box;
+		int Parent; // next free node while the node is in the free list
+		int Left, Right;
+		int Height;
+		int Body;
+
+		Node() : Parent(NullNode), Left(NullNode), Right(NullNode), Height(0), Body(-1) {}
+
+		bool IsLeaf() const {
+			return Left == NullNode;
+		}
+	};
+
+	struct NodePair {
+		int A, B;
+
+		NodePair(int A, int B) : A(A), B(B) {}
+	};
+
+	// Leaf with the Morton code of its box center, sorted by Rebuild
+	struct BuildLeaf {
+		uint32_t Code;
+		int Leaf;
+
+		BuildLeaf() : Code(0), Leaf(NullNode) {}
+		BuildLeaf(uint32_t Code, int Leaf) : Code(Code), Leaf(Leaf) {}
+	};
+
+	float FatMargin;
+	int root;
+	int freeList;
+	bool refitInactive;
+	std::vector<Node> nodes;
+	std::vector<int> bodyProxies;
+	std::vector<int> movedBodies;
+	std::vector<int> queryStack;
+	std::vector<BodyPair> trackedPairs;
+	std::vector<BodyPair> newPairs;
+	std::vector<BodyPair> mergedPairs;
+	std::vector<int> staleBodies;
+	std::vector<unsigned char> staleFlags;
+	std::vector<AABB> leafBoxes;
+	std::vector<BuildLeaf> buildLeaves;
+	std::vector<NodePair> nodePairs;
+
+	static bool PairLess(const BodyPair& a, const BodyPair& b) {
+		return a.A < b.A || (a.A == b.A && a.B < b.B);
+	}
+	static bool PairEqual(const BodyPair& a, const BodyPair& b) {
+		return a.A == b.A && a.B == b.B;
+	}
+
+	// Forgets the pairs of bodies whose index changed since the last call and queries the ones that
+	// still have a leaf again
+	void DropStalePairs() {
+		staleFlags.assign(*std::max_element(staleBodies.begin(), staleBodies.end()) + 1, 0);
+		for (int body : staleBodies) {
+			staleFlags[body] = 1;
+		}
+		int flagCount = static_cast<int>(staleFlags.size());
+		trackedPairs.erase(std::remove_if(trackedPairs.begin(), trackedPairs.end(),
+			[this, flagCount](const BodyPair& pair) {
+				return (pair.A < flagCount && staleFlags[pair.A]) || (pair.B < flagCount && staleFlags[pair.B]);
+			}), trackedPairs.end());
+
+		for (int body = 0; body < std::min(flagCount, static_cast<int>(bodyProxies.size())); body++) {
+			if (staleFlags[body] && bodyProxies[body] != NullNode) {
+				movedBodies.push_back(body);
+			}
+		}
+		staleBodies.clear();
+	}
+
+	int CreateProxy(const AABB& box, int body) {
+		int proxy = AllocateNode();
+		nodes[proxy].Box = box.Fattened(FatMargin);
+		nodes[proxy].Body = body;
+		nodes[proxy].Height = 0;
+		InsertLeaf(proxy);
+		return proxy;
+	}
+
+	// Builds the whole tree again once at least as many bodies arrive as it holds. The leaves are
+	// sorted once along a Morton curve of their centers and split in halves, one O(n log n) pass
+	// instead of a descent per leaf. Leaves already in the tree keep their fat boxes, so their
+	// tracked pairs stay valid.
+	void Rebuild(const std::vector<AABB>& boxes, int firstNew) {
+		int bodyCount = static_cast<int>(boxes.size());
+		leafBoxes.resize(bodyCount);
+		for (int i = 0; i < firstNew; i++) {
+			leafBoxes[i] = nodes[bodyProxies[i]].Box;
+		}
+		for (int i = firstNew; i < bodyCount; i++) {
+			leafBoxes[i] = boxes[i].Fattened(FatMargin);
+		}
+
+		AABB bounds = leafBoxes[0];
+		for (int i = 1; i < bodyCount; i++) {
+			bounds = AABB::Union(bounds, leafBoxes[i]);
+		}
+		float scaleX = 65535.0f / std::max(bounds.Max.x - bounds.Min.x, 1e-6f);
+		float scaleY = 65535.0f / std::max(bounds.Max.y - bounds.Min.y, 1e-6f);
+
+		nodes.clear();
+		nodes.reserve(2 * bodyCount);
+		freeList = NullNode;
+		bodyProxies.resize(bodyCount);
+		buildLeaves.resize(bodyCount);
+		for (int i = 0; i < bodyCount; i++) {
+			int leaf = AllocateNode();
+			nodes[leaf].Box = leafBoxes[i];
+			nodes[leaf].Body = i;
+			bodyProxies[i] = leaf;
+
+			FlatVector center = (leafBoxes[i].Min + leafBoxes[i].Max) * 0.5f;
+			uint32_t x = static_cast<uint32_t>((center.x - bounds.Min.x) * scaleX);
+			uint32_t y = static_cast<uint32_t>((center.y - bounds.Min.y) * scaleY);
+			buildLeaves[i] = BuildLeaf(SpreadBits(x) | (SpreadBits(y) << 1), leaf);
+		}
+		std::sort(buildLeaves.begin(), buildLeaves.end(),
+			[](const BuildLeaf& a, const BuildLeaf& b) { return a.Code < b.Code; });
+
+		root = BuildNode(0, bodyCount);
+		nodes[root].Parent = NullNode;
+	}
+
+	int BuildNode(int begin, int end) {
+		if (end - begin == 1) {
+			return buildLeaves[begin].Leaf;
+		}
+
+		int middle = begin + (end - begin) / 2;
+		int left = BuildNode(begin, middle);
+		int right = BuildNode(middle, end);
+		int parent = AllocateNode();
+		nodes[parent].Left = left;
+		nodes[parent].Right = right;
+		nodes[parent].Box = AABB::Union(nodes[left].Box, nodes[right].Box);
+		nodes[parent].Height = 1 + std::max(nodes[left].Height, nodes[right].Height);
+		nodes[left].Parent = parent;
+		nodes[right].Parent = parent;
+		return parent;
+	}
+
+	// Pairs of overlapping leaves with at least one body from firstNew on. After a rebuild the tree is
+	// descended against itself once, which visits each overlap once instead of querying every new leaf.
+	void QueryNewBodies(int firstNew, const std::vector<unsigned char>& inactive) {
+		if (root == NullNode) return;
+
+		nodePairs.clear();
+		nodePairs.push_back(NodePair(root, root));
+
+		while (!nodePairs.empty()) {
+			NodePair pair = nodePairs.back();
+			nodePairs.pop_back();
+			const Node& a = nodes[pair.A];
+			const Node& b = nodes[pair.B];
+
+			if (pair.A == pair.B) {
+				if (!a.IsLeaf()) {
+					nodePairs.push_back(NodePair(a.Left, a.Left));
+					nodePairs.push_back(NodePair(a.Right, a.Right));
+					nodePairs.push_back(NodePair(a.Left, a.Right));
+				}
+				continue;
+			}
+			if (!AABB::Overlap(a.Box, b.Box)) {
+				continue;
+			}
+
+			if (a.IsLeaf() && b.IsLeaf()) {
+				if ((a.Body >= firstNew || b.Body >= firstNew) && !(inactive[a.Body] && inactive[b.Body])) {
+					newPairs.push_back(BodyPair(std::min(a.Body, b.Body), std::max(a.Body, b.Body)));
+				}
+			}
+			else if (b.IsLeaf() || (!a.IsLeaf() && a.Height >= b.Height)) {
+				nodePairs.push_back(NodePair(a.Left, pair.B));
+				nodePairs.push_back(NodePair(a.Right, pair.B));
+			}
+			else {
+				nodePairs.push_back(NodePair(pair.A, b.Left));
+				nodePairs.push_back(NodePair(pair.A, b.Right));
+			}
+		}
+	}
+
+	// Moves the low 16 bits of value to the even bit positions
+	static uint32_t SpreadBits(uint32_t value) {
+		value &= 0xffff;
+		value = (value | (value << 8)) & 0x00ff00ff;
+		value = (value | (value << 4)) & 0x0f0f0f0f;
+		value = (value | (value << 2)) & 0x33333333;
+		value = (value | (value << 1)) & 0x55555555;
+		return value;
+	}
+
+	void DestroyProxy(int proxy) {
+		RemoveLeaf(proxy);
+		FreeNode(proxy);
+	}
+
+	void Query(const AABB& box, int body, const std::vector<unsigned char>& inactive) {
+		if (root == NullNode) return;
+
+		queryStack.clear();
+		queryStack.push_back(root);
+
+		while (!queryStack.empty()) {
+			int index = queryStack.back();
+			queryStack.pop_back();
+
+			const Node& node = nodes[index];
+			if (!AABB::Overlap(node.Box, box)) {
+				continue;
+			}
+
+			if (node.IsLeaf()) {
+				if (node.Body != body && !(inactive[node.Body] && inactive[body])) {
+					newPairs.push_back(BodyPair(std::min(node.Body, body), std::max(node.Body, body)));
+				}
+			}
+			else {
+				queryStack.push_back(node.Left);
+				queryStack.push_back(node.Right);
+			}
+		}
+	}
+
+	int AllocateNode() {
+		if (freeList == NullNode) {
+			nodes.push_back(Node());
+			return static_cast<int>(nodes.size()) - 1;
+		}
+
+		int index = freeList;
+		freeList = nodes[index].Parent;
+		nodes[index] = Node();
+		return index;
+	}
+
+	void FreeNode(int index) {
+		nodes[index].Parent = freeList;
+		nodes[index].Height = -1;
+		freeList = index;
+	}
+
+	void InsertLeaf(int leaf) {
+		if (root == NullNode) {
+			root = leaf;
+			nodes[root].Parent = NullNode;
+			return;
+		}
+
+		// Descend towards the sibling that grows the total perimeter the least
+		AABB leafBox = nodes[leaf].Box;
+		int index = root;
+		while (!nodes[index].IsLeaf()) {
+			int left = nodes[index].Left;
+			int right = nodes[index].Right;
+
+			float perimeter = nodes[index].Box.Perimeter();
+			float combinedPerimeter = AABB::Union(nodes[index].Box, leafBox).Perimeter();
+
+			float cost = 2.0f * combinedPerimeter;
+			float inheritanceCost = 2.0f * (combinedPerimeter - perimeter);
+
+			float costLeft = DescendCost(left, leafBox) + inheritanceCost;
+			float costRight = DescendCost(right, leafBox) + inheritanceCost;
+
+			if (cost < costLeft && cost < costRight) {
+				break;
+			}
+			index = costLeft < costRight ? left : right;
+		}
+
+		int sibling = index;
+		int oldParent = nodes[sibling].Parent;
+		int newParent = AllocateNode();
+		nodes[newParent].Parent = oldParent;
+		nodes[newParent].Box = AABB::Union(leafBox, nodes[sibling].Box);
+		nodes[newParent].Height = nodes[sibling].Height + 1;
+		nodes[newParent].Left = sibling;
+		nodes[newParent].Right = leaf;
+		nodes[sibling].Parent = newParent;
+		nodes[leaf].Parent = newParent;
+
+		if (oldParent != NullNode) {
+			if (nodes[oldParent].Left == sibling) nodes[oldParent].Left = newParent;
+			else nodes[oldParent].Right = newParent;
+		}
+		else {
+			root = newParent;
+		}
+
+		Refit(nodes[leaf].Parent);
+	}
+
+	void RemoveLeaf(int leaf) {
+		if (leaf == root) {
+			root = NullNode;
+			return;
+		}
+
+		int parent = nodes[leaf].Parent;
+		int grandParent = nodes[parent].Parent;
+		int sibling = nodes[parent].Left == leaf ? nodes[parent].Right : nodes[parent].Left;
+
+		if (grandParent != NullNode) {
+			if (nodes[grandParent].Left == parent) nodes[grandParent].Left = sibling;
+			else nodes[grandParent].Right = sibling;
+			nodes[sibling].Parent = grandParent;
+			FreeNode(parent);
+			Refit(grandParent);
+		}
+		else {
+			root = sibling;
+			nodes[sibling].Parent = NullNode;
+			FreeNode(parent);
+		}
+	}
+
+	float DescendCost(int child, const AABB& leafBox) const {
+		float combinedPerimeter = AABB::Union(leafBox, nodes[child].Box).Perimeter();
+		if (nodes[child].IsLeaf()) {
+			return combinedPerimeter;
+		}
+		return combinedPerimeter - nodes[child].Box.Perimeter();
+	}
+
+	void Refit(int index) {
+		while (index != NullNode) {
+			index = Balance(index);
+
+			Node& node = nodes[index];
+			node.Height = 1 + std::max(nodes[node.Left].Height, nodes[node.Right].Height);
+			node.Box = AABB::Union(nodes[node.Left].Box, nodes[node.Right].Box);
+
+			index = node.Parent;
+		}
+	}
+
+	// Rotates the taller child of iA up when the subtree heights differ by more than one
+	int Balance(int iA) {
+		Node& A = nodes[iA];
+		if (A.IsLeaf() || A.Height < 2) {
+			return iA;
+		}
+
+		int iB = A.Left;
+		int iC = A.Right;
+		Node& B = nodes[iB];
+		Node& C = nodes[iC];
+
+		int balance = C.Height - B.Height;
+
+		if (balance > 1) {
+			int iF = C.Left;
+			int iG = C.Right;
+			Node& F = nodes[iF];
+			Node& G = nodes[iG];
+
+			C.Left = iA;
+			C.Parent = A.Parent;
+			A.Parent = iC;
+			ReplaceChild(C.Parent, iA, iC);
+
+			if (F.Height > G.Height) {
+				C.Right = iF;
+				A.Right = iG;
+				G.Parent = iA;
+				A.Box = AABB::Union(B.Box, G.Box);
+				C.Box = AABB::Union(A.Box, F.Box);
+				A.Height = 1 + std::max(B.Height, G.Height);
+				C.Height = 1 + std::max(A.Height, F.Height);
+			}
+			else {
+				C.Right = iG;
+				A.Right = iF;
+				F.Parent = iA;
+				A.Box = AABB::Union(B.Box, F.Box);
+				C.Box = AABB::Union(A.Box, G.Box);
+				A.Height = 1 + std::max(B.Height, F.Height);
+				C.Height = 1 + std::max(A.Height, G.Height);
+			}
+			return iC;
+		}
+
+		if (balance < -1) {
+			int iD = B.Left;
+			int iE = B.Right;
+			Node& D = nodes[iD];
+			Node& E = nodes[iE];
+
+			B.Left = iA;
+			B.Parent = A.Parent;
+			A.Parent = iB;
+			ReplaceChild(B.Parent, iA, iB);
+
+			if (D.Height > E.Height) {
+				B.Right = iD;
+				A.Left = iE;
+				E.Parent = iA;
+				A.Box = AABB::Union(C.Box, E.Box);
+				B.Box = AABB::Union(A.Box, D.Box);
+				A.Height = 1 + std::max(C.Height, E.Height);
+				B.Height = 1 + std::max(A.Height, D.Height);
+			}
+			else {
+				B.Right = iE;
+				A.Left = iD;
+				D.Parent = iA;
+				A.Box = AABB::Union(C.Box, D.Box);
+				B.Box = AABB::Union(A.Box, E.Box);
+				A.Height = 1 + std::max(C.Height, D.Height);
+				B.Height = 1 + std::max(A.Height, E.Height);
+			}
+			return iB;
+		}
+
+		return iA;
+	}
+
+	void ReplaceChild(int parent, int oldChild, int newChild) {
+		if (parent == NullNode) {
+			root = newChild;
+		}
+		else if (nodes[parent].Left == oldChild) {
+			nodes[parent].Left = newChild;
+		}
+		else {
+			nodes[parent].Right = newChild;
+		}
+	}
+};
@@ -1,9 +1,15 @@
-#pragma once[]
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
 #include <Bodies.h>
+#include <BodyStore.h>
 #include <Vector.h>
-#include <iomanip>
+#include <SatKernels.h>
+#include <Contact.h>
+
 class Intersections {
 public:
 
@@ -30,7 +36,59 @@ public:
         return true;
     }
     
-    static bool IntersectPolygons(const FlatVector& centerA, const std::vector<FlatVector>& verticesA, const FlatVector& centerB, const std::vector<FlatVector>& verticesB, FlatVector& normal, float& depth)
+    // Separating axis test on cached world-space vertices and unit edge normals (see BodyStore::UpdateWorldShapes).
+    // The axes are projected in batches of SatKernels::MaxAxes.
+    static bool IntersectPolygons(const FlatVector& centerA, FlatVectorSpan verticesA, FlatVectorSpan normalsA,
+        const FlatVector& centerB, FlatVectorSpan verticesB, FlatVectorSpan normalsB, FlatVector& normal, float& depth)
+    {
+        float axesX[SatKernels::MaxAxes], axesY[SatKernels::MaxAxes];
+        float minA[SatKernels::MaxAxes], maxA[SatKernels::MaxAxes], minB[SatKernels::MaxAxes], maxB[SatKernels::MaxAxes];
+
+        int countA = static_cast<int>(normalsA.size());
+        int axisCount = countA + static_cast<int>(normalsB.size());
+
+        normal = FlatVector();
+        depth = std::numeric_limits<float>::max();
+
+        for (int base = 0; base < axisCount; base += SatKernels::MaxAxes)
+        {
+            int batch = std::min(SatKernels::MaxAxes, axisCount - base);
+            for (int k = 0; k < batch; k++) {
+                const FlatVector& axis = base + k < countA ? normalsA[base + k] : normalsB[base + k - countA];
+                axesX[k] = axis.x;
+                axesY[k] = axis.y;
+            }
+
+            SatKernels::ProjectVertices(verticesA, axesX, axesY, batch, minA, maxA);
+            SatKernels::ProjectVertices(verticesB, axesX, axesY, batch, minB, maxB);
+
+            for (int k = 0; k < batch; k++)
+            {
+                if (minA[k] > maxB[k] || minB[k] > maxA[k]) {
+                    return false;
+                }
+
+                float axisDepth = std::min(maxB[k] - minA[k], maxA[k] - minB[k]);
+
+                if (axisDepth < depth) {
+                    depth = axisDepth;
+                    normal = FlatVector(axesX[k], axesY[k]);
+                }
+            }
+        }
+
+        // Normal points from A to B, like CircleIntersection
+        FlatVector centerAtoB = centerB - centerA;
+        if (FlatVector::Dot(centerAtoB, normal) < 0)
+        {
+            normal = -normal;
+        }
+
+        return true;
+    }
+
+    // Reference implementation on local vertices around the centers, one axis at a time
+    static bool IntersectPolygonsScalar(const FlatVector& centerA, FlatVectorSpan verticesA, const FlatVector& centerB, FlatVectorSpan verticesB, FlatVector& normal, float& depth)
     {
         normal = FlatVector();
         depth = std::numeric_limits<float>::max();
@@ -85,9 +143,9 @@ public:
             }
         }
 
-        FlatVector centerBtoA = centerB - centerA;
-        FlatVector overlap = normal * depth;
-        if (FlatVector::Dot(overlap, centerBtoA) > 0)
+        // Normal points from A to B, like CircleIntersection
+        FlatVector centerAtoB = centerB - centerA;
+        if (FlatVector::Dot(centerAtoB, normal) < 0)
         {
             normal = -normal;
         }
@@ -95,7 +153,80 @@ public:
         return true;
     }
 
-    static bool IntersectCirclePolygon(const FlatVector circleCenter, const float circleRadius, const FlatVector polygonCenter, const std::vector<FlatVector> vertices, FlatVector& normal, float& depth)
+    // Circle against cached world-space polygon vertices and unit edge normals
+    static bool IntersectCirclePolygon(const FlatVector& circleCenter, const float circleRadius, const FlatVector& polygonCenter, FlatVectorSpan vertices,
+        FlatVectorSpan normals, FlatVector& normal, float& depth)
+    {
+        float axesX[SatKernels::MaxAxes], axesY[SatKernels::MaxAxes];
+        float minsA[SatKernels::MaxAxes], maxsA[SatKernels::MaxAxes];
+
+        int axisCount = static_cast<int>(normals.size());
+
+        normal = FlatVector();
+        depth = std::numeric_limits<float>::max();
+
+        float axisDepth = 0.0f;
+        float minA, maxA, minB, maxB;
+
+        for (int base = 0; base < axisCount; base += SatKernels::MaxAxes)
+        {
+            int batch = std::min(SatKernels::MaxAxes, axisCount - base);
+            for (int k = 0; k < batch; k++) {
+                axesX[k] = normals[base + k].x;
+                axesY[k] = normals[base + k].y;
+            }
+
+            SatKernels::ProjectVertices(vertices, axesX, axesY, batch, minsA, maxsA);
+
+            for (int k = 0; k < batch; k++)
+            {
+                const FlatVector& axis = normals[base + k];
+                ProjectCircle(circleCenter, circleRadius, axis, minB, maxB);
+
+                if (minsA[k] > maxB || minB > maxsA[k]) {
+                    return false;
+                }
+
+                axisDepth = std::min(maxB - minsA[k], maxsA[k] - minB);
+
+                if (axisDepth < depth) {
+                    depth = axisDepth;
+                    normal = axis;
+                }
+            }
+        }
+
+        int cpIndex = FindClosestPointOnPolygon(circleCenter, vertices);
+        FlatVector axis = vertices[cpIndex] - circleCenter;
+        FlatVector::NormalizedVector(axis);
+
+        SatKernels::ProjectVertices(vertices, &axis.x, &axis.y, 1, &minA, &maxA);
+        ProjectCircle(circleCenter, circleRadius, axis, minB, maxB);
+
+        if (minA > maxB || minB > maxA)
+        {
+            return false;
+        }
+
+        axisDepth = std::min(maxB - minA, maxA - minB);
+
+        if (axisDepth < depth)
+        {
+            depth = axisDepth;
+            normal = axis;
+        }
+
+        // Normal points from the circle to the polygon
+        if (FlatVector::Dot(polygonCenter - circleCenter, normal) < 0)
+        {
+            normal = -normal;
+        }
+
+        return true;
+    }
+
+    // Reference implementation on local vertices around the polygon center, one axis at a time
+    static bool IntersectCirclePolygonScalar(const FlatVector& circleCenter, const float circleRadius, const FlatVector& polygonCenter, FlatVectorSpan vertices, FlatVector& normal, float& depth)
     {
         normal = FlatVector();
         depth = std::numeric_limits<float>::max();
@@ -123,22 +254,11 @@ public:
 
             if (axisDepth < depth){
                 depth = axisDepth;
-
-                if (axisDepth == maxB - minA)
-                {
-                    normal = axis;
-                }
-                else
-                {
-                    FlatVector closestPoint = va + polygonCenter;
-                    FlatVector vertexNormal = closestPoint - circleCenter;
-                    FlatVector::NormalizedVector(vertexNormal);
-                    normal = vertexNormal;
-                }
+                normal = axis;
             }
         }
         
-        int cpIndex = FindClosestPointOnPolygon(circleCenter, vertices);
+        int cpIndex = FindClosestPointOnPolygon(circleCenter - polygonCenter, vertices);
         FlatVector closestPoint = vertices[cpIndex] + polygonCenter;
 
         FlatVector axis = closestPoint - circleCenter;
@@ -159,11 +279,17 @@ public:
             depth = axisDepth;
             normal = axis;
         }
-        
+
+        // Normal points from the circle to the polygon
+        if (FlatVector::Dot(polygonCenter - circleCenter, normal) < 0)
+        {
+            normal = -normal;
+        }
+
         return true;
     }
 
-    static bool IntersectLiquidCircle(const FlatVector& circleCenter, const float circleRadius, const std::vector<FlatVector>& boundaries) {
+    static bool IntersectLiquidCircle(const FlatVector& circleCenter, const float circleRadius, FlatVectorSpan boundaries) {
         float closestX = std::max(boundaries[0].x, std::min(circleCenter.x, boundaries[1].x));
         float closestY = std::max(boundaries[2].y, std::min(circleCenter.y, boundaries[1].y));
 
@@ -174,32 +300,59 @@ public:
         return distanceSquared < (circleRadius * circleRadius);
     }
 
-    static void FindContactPoints(const Bodies& bodyA, const Bodies& bodyB, FlatVector& collisionPoint0, FlatVector& collisionPoint1, int& contactCount)
+    // Area of a convex polygon inside an axis-aligned box, such as a liquid below its surface. The
+    // polygon is clipped against one side of the box at a time (Sutherland-Hodgman) in two scratch
+    // buffers kept by the caller.
+    static float ClippedArea(FlatVectorSpan vertices, const AABB& box, std::vector<FlatVector>& bufferA, std::vector<FlatVector>& bufferB)
     {
-        collisionPoint0 = FlatVector();
-        collisionPoint1 = FlatVector();
-        contactCount = 0;
+        bufferA.assign(vertices.begin(), vertices.end());
+        ClipAxis(bufferA, bufferB, false, box.Max.y, 1.0f);  // the surface
+        ClipAxis(bufferB, bufferA, false, box.Min.y, -1.0f);
+        ClipAxis(bufferA, bufferB, true, box.Max.x, 1.0f);
+        ClipAxis(bufferB, bufferA, true, box.Min.x, -1.0f);
+
+        float area = 0.0f;
+        for (size_t i = 0; i < bufferA.size(); i++) {
+            const FlatVector& a = bufferA[i];
+            const FlatVector& b = bufferA[(i + 1) % bufferA.size()];
+            area += a.x * b.y - a.y * b.x;
+        }
+        return 0.5f * std::fabs(area);
+    }
 
-        if (bodyA.Type == Bodies::ShapeType::Polygon)
+    // Fills the contact points and their depths of a contact whose Normal and Depth are already set.
+    // Polygons are given by their cached world-space vertices and edge normals. Two polygons are
+    // clipped against an edge of the preferred reference body (0 for A, 1 for B, -1 for either) as
+    // long as that body has an edge nearly as parallel to the normal as the other's.
+    static void FindContactPoints(const FlatVector& positionA, const BodyShape& shapeA, float radiusA, FlatVectorSpan verticesA, FlatVectorSpan normalsA,
+        const FlatVector& positionB, const BodyShape& shapeB, FlatVectorSpan verticesB, FlatVectorSpan normalsB, int preferredReference, Contact& contact)
+    {
+        contact.Point0 = FlatVector();
+        contact.Point1 = FlatVector();
+        contact.Depth0 = contact.Depth;
+        contact.Depth1 = 0.0f;
+        contact.PointCount = 1;
+        contact.Reference = -1;
+        contact.Feature0 = 0;
+        contact.Feature1 = 0;
+
+        if (shapeA.Type == Bodies::ShapeType::Polygon)
         {
-            if (bodyB.Type == Bodies::ShapeType::Polygon) {
-                FindContactPoint(bodyA.Position, bodyA.Vertices, bodyB.Position, bodyB.Vertices, collisionPoint0, collisionPoint1, contactCount);
+            if (shapeB.Type == Bodies::ShapeType::Polygon) {
+                ClipPolygons(verticesA, normalsA, verticesB, normalsB, preferredReference, contact);
             }
-            else if (bodyB.Type == Bodies::ShapeType::Circle) {
-                FindContactPoint(bodyB.Position, bodyB.Radius, bodyA.Position, bodyA.Vertices, collisionPoint0);
-                contactCount = 1;
+            else if (shapeB.Type == Bodies::ShapeType::Circle) {
+                FindContactPoint(positionB, verticesA, contact.Point0);
             }
         }
 
-        if (bodyA.Type == Bodies::ShapeType::Circle)
+        if (shapeA.Type == Bodies::ShapeType::Circle)
         {
-            if (bodyB.Type == Bodies::ShapeType::Polygon) {
-                FindContactPoint(bodyA.Position, bodyA.Radius, bodyB.Position, bodyB.Vertices, collisionPoint0);
-                contactCount = 1;
+            if (shapeB.Type == Bodies::ShapeType::Polygon) {
+                FindContactPoint(positionA, verticesB, contact.Point0);
             }
-            else if (bodyB.Type == Bodies::ShapeType::Circle) {
-                FindContactPoint(bodyA.Position, bodyA.Radius, bodyB.Position, collisionPoint0);
-                contactCount = 1;
+            else if (shapeB.Type == Bodies::ShapeType::Circle) {
+                FindContactPoint(positionA, radiusA, positionB, contact.Point0);
             }
         }
     }
@@ -213,10 +366,10 @@ private:
         collisionPoint = centerA + (VecAtoB * radiusA);
     }
 
-    static void FindContactPoint(const FlatVector& circleCenter, float radius, const FlatVector& polygonCenter, const std::vector<FlatVector> vertices, 
-        FlatVector& collisionPoint)
+    // Closest point of the polygon outline to the circle center
+    static void FindContactPoint(const FlatVector& circleCenter, FlatVectorSpan vertices, FlatVector& collisionPoint)
     {
-        float distanceSquered, minDistanceSquered= std::numeric_limits<float>::min();
+        float distanceSquered, minDistanceSquered = std::numeric_limits<float>::max();
         FlatVector ContactPoint;
         for (int i = 0; i < vertices.size(); i++)
         {
@@ -232,66 +385,142 @@ private:
         }
     }
 
-    static void FindContactPoint(const FlatVector& polygonCenterA, const std::vector<FlatVector> verticesA, const FlatVector& polygonCenterB, const std::vector<FlatVector> verticesB,
-        FlatVector& collisionPoint0, FlatVector& collisionPoint1, int& contactCount)
-    {
-        contactCount = 0;
-        float distanceSquered, minDistanceSquered = std::numeric_limits<float>::min();
-        FlatVector ContactPoint;
-
-        for (int i = 0; i < verticesA.size(); i++) {
-            FlatVector p = verticesA[i];
+    static constexpr float ContactTolerance = 0.001f;
+    static constexpr float ReferenceTolerance = 0.05f; // alignment a preferred reference edge may lose before it is given up
 
-            for (int j = 0; j < verticesB.size(); j++) {
-                FlatVector va = verticesB[j];
-                FlatVector vb = verticesB[(j + 1) % verticesB.size()];
+    // Feature of a clipped point: the reference and incident edges and the vertex of the reference edge
+    // (0 or 1) whose side plane bounds the point. A point keeps its feature when an incident vertex
+    // slides past the side plane and the cut at the plane takes its place, as resting boxes with
+    // flush sides do from one step to the next.
+    static uint32_t ClipFeature(int referenceEdge, int incidentEdge, int side)
+    {
+        return (static_cast<uint32_t>(referenceEdge) << 16) | (static_cast<uint32_t>(incidentEdge) << 1) | static_cast<uint32_t>(side);
+    }
 
-                VectorPointDistance(p, va, vb, distanceSquered, ContactPoint);
-                 
-                if (FlatVector::NearlyEqual(distanceSquered,minDistanceSquered)) {
-                    if (!FlatVector::DistanceSquared(collisionPoint0,collisionPoint1)) {
-                        collisionPoint1 = ContactPoint;
-                        contactCount = 2;
-                    }
-                }
-                if (distanceSquered < minDistanceSquered) {
-                    minDistanceSquered = distanceSquered;
-                    collisionPoint0 = ContactPoint;
-                    contactCount = 1;
-                }
-                if (contactCount = 2) return;
+    // Two-point manifold of touching polygons: the edge most facing the other body is the reference,
+    // the other body's most opposed edge is clipped against its side planes and every clipped point
+    // behind the reference edge becomes a contact point with its own depth and clip feature.
+    static void ClipPolygons(FlatVectorSpan verticesA, FlatVectorSpan normalsA,
+        FlatVectorSpan verticesB, FlatVectorSpan normalsB, int preferredReference, Contact& contact)
+    {
+        int edgeA = FindMostAlignedEdge(normalsA, contact.Normal);
+        int edgeB = FindMostAlignedEdge(normalsB, -contact.Normal);
+        float alignmentA = FlatVector::Dot(normalsA[edgeA], contact.Normal);
+        float alignmentB = -FlatVector::Dot(normalsB[edgeB], contact.Normal);
+
+        // The reference body of the last step is kept while its edge stays nearly as aligned, so the
+        // points and their features do not depend on the order the pair comes in. A new pair prefers
+        // A unless B's face is clearly more parallel to the normal.
+        bool flip;
+        if (preferredReference == 0) flip = alignmentB > alignmentA + ReferenceTolerance;
+        else if (preferredReference == 1) flip = alignmentA <= alignmentB + ReferenceTolerance;
+        else flip = alignmentB > alignmentA + 0.0005f;
+
+        FlatVectorSpan referenceVertices = flip ? verticesB : verticesA;
+        FlatVectorSpan incidentVertices = flip ? verticesA : verticesB;
+        FlatVectorSpan incidentNormals = flip ? normalsA : normalsB;
+        int referenceEdge = flip ? edgeB : edgeA;
+        FlatVector referenceNormal = flip ? normalsB[edgeB] : normalsA[edgeA];
+        // The solver pushes along the reference edge's normal, which the point depths are measured on,
+        // rather than along whichever axis of almost equal depth the separating axis test ended on
+        contact.Normal = flip ? -referenceNormal : referenceNormal;
+
+        const FlatVector& reference0 = referenceVertices[referenceEdge];
+        const FlatVector& reference1 = referenceVertices[(referenceEdge + 1) % referenceVertices.size()];
+        int incidentEdge = FindMostAlignedEdge(incidentNormals, -referenceNormal);
+
+        FlatVector incident[2] = { incidentVertices[incidentEdge], incidentVertices[(incidentEdge + 1) % incidentVertices.size()] };
+        FlatVector tangent = reference1 - reference0;
+        FlatVector::NormalizedVector(tangent);
+
+        FlatVector clipped[2];
+        // A failed clip writes nothing, so the incident edge is left as it was
+        bool beside = ClipSegment(incident, clipped, -tangent, -FlatVector::Dot(tangent, reference0)) == 2
+            && ClipSegment(clipped, incident, tangent, FlatVector::Dot(tangent, reference1)) == 2;
+        int firstSide = FlatVector::Dot(tangent, incident[0]) <= FlatVector::Dot(tangent, incident[1]) ? 0 : 1;
+        uint32_t features[2] = { ClipFeature(referenceEdge, incidentEdge, firstSide), ClipFeature(referenceEdge, incidentEdge, 1 - firstSide) };
+
+        int count = 0;
+        int deepest = 0;
+        float separations[2];
+        FlatVector* points[2] = { &contact.Point0, &contact.Point1 };
+        float* depths[2] = { &contact.Depth0, &contact.Depth1 };
+        uint32_t* pointFeatures[2] = { &contact.Feature0, &contact.Feature1 };
+        for (int i = 0; i < 2; i++) {
+            // Points resting exactly on the reference edge are kept despite rounding
+            separations[i] = FlatVector::Dot(referenceNormal, incident[i] - reference0);
+            if (separations[i] < separations[deepest]) deepest = i;
+            if (beside && separations[i] <= ContactTolerance) {
+                *points[count] = incident[i];
+                *depths[count] = std::max(0.0f, -separations[i]);
+                *pointFeatures[count] = features[i];
+                count++;
             }
         }
+        // The separating axis test found an overlap, so a manifold whose points all lie above or beside
+        // the reference edge keeps the deepest one rather than a point at the origin
+        if (count == 0) {
+            contact.Point0 = incident[deepest];
+            contact.Feature0 = features[deepest];
+            count = 1;
+        }
+        contact.PointCount = count;
+        contact.Reference = flip ? contact.B : contact.A;
+    }
 
-        for (int i = 0; i < verticesB.size(); i++) {
-            FlatVector p = verticesB[i];
-
-            for (int j = 0; j < verticesA.size(); j++) {
-                FlatVector va = verticesA[j];
-                FlatVector vb = verticesA[(j + 1) % verticesA.size()];
+    static int FindMostAlignedEdge(FlatVectorSpan normals, const FlatVector& direction)
+    {
+        int result = 0;
+        float maxDot = -std::numeric_limits<float>::max();
 
-                VectorPointDistance(p, va, vb, distanceSquered, ContactPoint);
+        for (int i = 0; i < normals.size(); i++) {
+            float dot = FlatVector::Dot(normals[i], direction);
+            if (dot > maxDot) {
+                maxDot = dot;
+                result = i;
+            }
+        }
+        return result;
+    }
 
-                if (FlatVector::NearlyEqual(distanceSquered, minDistanceSquered)) {
-                    if (!FlatVector::DistanceSquared(collisionPoint0, collisionPoint1)) {
-                        collisionPoint1 = ContactPoint;
-                        contactCount = 2;
-                    }
-                }
-                if (distanceSquered < minDistanceSquered) {
-                    minDistanceSquered = distanceSquered;
-                    collisionPoint0 = ContactPoint;
-                    contactCount = 1;
-                }
-                if (contactCount == 2) return;
+    // Keeps the part of the polygon with side * (coordinate - limit) <= 0, on the x or the y axis
+    static void ClipAxis(const std::vector<FlatVector>& input, std::vector<FlatVector>& output, bool xAxis, float limit, float side)
+    {
+        output.clear();
+        for (size_t i = 0; i < input.size(); i++) {
+            const FlatVector& a = input[i];
+            const FlatVector& b = input[(i + 1) % input.size()];
+            float distanceA = side * ((xAxis ? a.x : a.y) - limit);
+            float distanceB = side * ((xAxis ? b.x : b.y) - limit);
+
+            if (distanceA <= 0.0f) {
+                output.push_back(a);
+            }
+            if ((distanceA < 0.0f && distanceB > 0.0f) || (distanceA > 0.0f && distanceB < 0.0f)) {
+                output.push_back(a + (b - a) * (distanceA / (distanceA - distanceB)));
             }
         }
     }
 
-    static void ProjectVertices(const FlatVector& center, const std::vector<FlatVector>& vertices, const FlatVector& axis, float& min, float& max)
+    // Keeps the part of the segment with dot(normal, p) <= offset
+    static int ClipSegment(const FlatVector in[2], FlatVector out[2], const FlatVector& normal, float offset)
+    {
+        int count = 0;
+        float distance0 = FlatVector::Dot(normal, in[0]) - offset;
+        float distance1 = FlatVector::Dot(normal, in[1]) - offset;
+
+        if (distance0 <= 0.0f) out[count++] = in[0];
+        if (distance1 <= 0.0f) out[count++] = in[1];
+        if (distance0 * distance1 < 0.0f) {
+            out[count++] = in[0] + (in[1] - in[0]) * (distance0 / (distance0 - distance1));
+        }
+        return count;
+    }
+
+    static void ProjectVertices(const FlatVector& center, FlatVectorSpan vertices, const FlatVector& axis, float& min, float& max)
     {
         min = std::numeric_limits<float>::max();
-        max = std::numeric_limits<float>::min();
+        max = std::numeric_limits<float>::lowest();
 
         for (const auto& v : vertices) {
             FlatVector vertex = v + center;
@@ -302,9 +531,6 @@ private:
     }
     static void ProjectCircle(const FlatVector& center, const float& radius, const FlatVector& axis, float& min, float& max)
     {
-        min = std::numeric_limits<float>::max();
-        max = std::numeric_limits<float>::min();
-
         FlatVector directionAndRadius = axis * radius;
 
         FlatVector p1 = center + directionAndRadius;
@@ -331,7 +557,7 @@ private:
         if (d <= 0) {
             collisionPoint = firstPoint;
         }
-        else if (d >= 0) {
+        else if (d >= 1) {
             collisionPoint = secondPoint;
         }
         else {
@@ -340,7 +566,7 @@ private:
         distanceSquered = FlatVector::DistanceSquared(collisionPoint, point);
     }
 
-    static int FindClosestPointOnPolygon(const FlatVector circleCenter, const std::vector<FlatVector> vertices)
+    static int FindClosestPointOnPolygon(const FlatVector& circleCenter, FlatVectorSpan vertices)
     {
         int result = -1;
         float minDistance = std::numeric_limits<float>::max();
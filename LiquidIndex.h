@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include <AABB.h>
+#include <CellHashTable.h>
+#include <Liquids.h>
+
+// Uniform grid over the bounding boxes of the liquids, built again only when liquids are added or
+// removed. A body tests just the liquids registered in the cells its box covers, so the per-step cost
+// follows the liquids near each body rather than how many liquids the world holds. Cells are as
+// large as the average liquid; a liquid covering more than CellHashTable::MaxCells cells, such as a
+// sea among small pools, is kept in a short list tested by every query instead.
+class LiquidIndex {
+public:
+
+	size_t GetLiquidCount() const {
+		return bounds.size();
+	}
+
+	// Box of the liquid's boundaries, the volume bodies are clipped against
+	const AABB& GetBounds(int liquid) const {
+		return bounds[liquid];
+	}
+
+	void Build(const std::vector<Liquids>& liquids) {
+		bounds.resize(liquids.size());
+		float extentSum = 0.0f;
+		int finiteCount = 0;
+		for (size_t i = 0; i < liquids.size(); i++) {
+			bounds[i] = ComputeBounds(liquids[i].FluidBoundries);
+			if (!CellHashTable::IsFinite(bounds[i])) continue;
+			extentSum += std::max(bounds[i].Max.x - bounds[i].Min.x, bounds[i].Max.y - bounds[i].Min.y);
+			finiteCount++;
+		}
+		cellSize = finiteCount > 0 && extentSum > 0.0f ? extentSum / finiteCount : 1.0f;
+		invCellSize = 1.0f / cellSize;
+
+		cells.Clear();
+		largeLiquids.clear();
+		for (int i = 0; i < static_cast<int>(bounds.size()); i++) {
+			if (!CellHashTable::IsFinite(bounds[i]) || CellHashTable::CellCount(bounds[i], invCellSize) > CellHashTable::MaxCells) {
+				largeLiquids.push_back(i);
+				continue;
+			}
+			cells.Insert(bounds[i], invCellSize, i);
+		}
+		cells.Build();
+
+		visitStamps.assign(bounds.size(), 0);
+		stamp = 0;
+	}
+
+	// Liquids whose box overlaps box, each listed once
+	void Query(const AABB& box, std::vector<int>& liquids) {
+		liquids.clear();
+		if (bounds.empty() || !CellHashTable::IsFinite(box)) return;
+
+		if (++stamp == 0) {
+			std::fill(visitStamps.begin(), visitStamps.end(), 0u);
+			stamp = 1;
+		}
+
+		for (int liquid : largeLiquids) {
+			visitStamps[liquid] = stamp;
+			if (AABB::Overlap(box, bounds[liquid])) {
+				liquids.push_back(liquid);
+			}
+		}
+
+		int minX = CellCoord(box.Min.x);
+		int minY = CellCoord(box.Min.y);
+		int maxX = CellCoord(box.Max.x);
+		int maxY = CellCoord(box.Max.y);
+
+		// A body larger than many cells reads the boxes directly
+		if (static_cast<int64_t>(maxX - minX + 1) * (maxY - minY + 1) > static_cast<int64_t>(bounds.size())) {
+			for (int liquid = 0; liquid < static_cast<int>(bounds.size()); liquid++) {
+				if (visitStamps[liquid] != stamp && AABB::Overlap(box, bounds[liquid])) {
+					visitStamps[liquid] = stamp;
+					liquids.push_back(liquid);
+				}
+			}
+			return;
+		}
+
+		for (int y = minY; y <= maxY; y++) {
+			for (int x = minX; x <= maxX; x++) {
+				unsigned int bucket = cells.GetBucket(x, y);
+				for (const CellHashTable::Entry* entry = cells.BucketBegin(bucket); entry != cells.BucketEnd(bucket); entry++) {
+					if (entry->X != x || entry->Y != y || visitStamps[entry->Id] == stamp) {
+						continue;
+					}
+					visitStamps[entry->Id] = stamp;
+					if (AABB::Overlap(box, bounds[entry->Id])) {
+						liquids.push_back(entry->Id);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	float cellSize = 1.0f;
+	float invCellSize = 1.0f;
+	std::vector<AABB> bounds;
+	std::vector<int> largeLiquids;
+	CellHashTable cells;
+	std::vector<uint32_t> visitStamps;
+	uint32_t stamp = 0;
+
+	int CellCoord(float value) const {
+		return CellHashTable::CellCoord(value, invCellSize);
+	}
+
+	static AABB ComputeBounds(const std::vector<FlatVector>& vertices) {
+		if (vertices.empty()) return AABB();
+
+		AABB box(vertices[0], vertices[0]);
+		for (const auto& vertex : vertices) {
+			box = AABB::Union(box, AABB(vertex, vertex));
+		}
+		return box;
+	}
+};
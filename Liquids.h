@@ -15,10 +15,10 @@ public:
 	};
 	LiquidType LType;
 
-	Liquids(float Density, float Viscosity, float Tension, std::vector<FlatVector> FluidBoundries, LiquidType LType, float HighestBoundry) : 
+	Liquids(float Density, float Viscosity, float Tension, const std::vector<FlatVector>& FluidBoundries, LiquidType LType, float HighestBoundry) : 
 		Density(Density), Viscosity(Viscosity), Tension(Tension), FluidBoundries(FluidBoundries), LType(LType), HighestBoundry(HighestBoundry){}
 
-	static Liquids CreateBodyOfWater(std::vector<FlatVector> FluidBoundries) {
+	static Liquids CreateBodyOfWater(const std::vector<FlatVector>& FluidBoundries) {
 		float densityOfWater = 997; // [kg/m^3]
 		float tension = 72; // [mN/m]
 		float HighestBoundry = FindHighestBoundry(FluidBoundries);
@@ -26,9 +26,11 @@ public:
 	}
 
 private:
-	static float FindHighestBoundry(std::vector<FlatVector> FluidBoundries) {
-		float HighestBoundry = 0;
-		for (int i = 0; i < FluidBoundries.size(); i++) {
+	// The surface, also for liquids entirely below y = 0
+	static float FindHighestBoundry(const std::vector<FlatVector>& FluidBoundries) {
+		if (FluidBoundries.empty()) return 0;
+		float HighestBoundry = FluidBoundries[0].y;
+		for (size_t i = 1; i < FluidBoundries.size(); i++) {
 			if (HighestBoundry < FluidBoundries[i].y) HighestBoundry = FluidBoundries[i].y;
 		}
 		return HighestBoundry;
@@ -1,12 +1,16 @@
 #pragma once
 
+#include<array>
 #include<vector>
+
+// Color is held inline, so copying a material does not touch the heap
 	class Materials {
 	private:
 
 	public:
 		float Density;
-		std::vector<float> Color;
+		float Friction; // Coulomb coefficient, mixed per contact as the geometric mean
+		std::array<float, 3> Color;
 		enum MaterialType {
 			Birch,
 			Steel,
@@ -16,45 +20,72 @@
 		};
 		MaterialType MType;
 
-		Materials(float Density, std::vector<float> Color, MaterialType MType) : Density(Density), Color(Color), MType(MType) {}
+		Materials(float Density, const std::array<float, 3>& Color, MaterialType MType, float Friction = 0.5f) : Density(Density), Friction(Friction), Color(Color), MType(MType) {}
 
 		static Materials CreateBirch() {
 			float red = 222.0f / 255.0f;
 			float green = 184.0f / 255.0f;
 			float blue = 135.0f / 255.0f;
-			std::vector<float> color = { red, green, blue };
-			return Materials(610.0f, color, MaterialType::Birch);
+			std::array<float, 3> color = { red, green, blue };
+			return Materials(610.0f, color, MaterialType::Birch, 0.5f);
 		}
 
 		static Materials CreateSteel() {
 			float Red = 70.0f / 255.0f;
 			float Green = 130.0f / 255.0f;
 			float Blue = 180.0f / 255.0f;
-			std::vector<float> steelColor = { Red, Green, Blue };
-			return Materials(7850.0f, steelColor, MaterialType::Steel);
+			std::array<float, 3> steelColor = { Red, Green, Blue };
+			return Materials(7850.0f, steelColor, MaterialType::Steel, 0.4f);
 		}
 
 		static Materials CreateOak() {
 			float red = 139.0f / 255.0f;
 			float green = 69.0f / 255.0f;
 			float blue = 19.0f / 255.0f;
-			std::vector<float> color = { red, green, blue };
-			return Materials(710.0f, color, MaterialType::Oak);
+			std::array<float, 3> color = { red, green, blue };
+			return Materials(710.0f, color, MaterialType::Oak, 0.5f);
 		}
 
 		static Materials CreateGlass() {
 			float red = 0.0f / 255.0f;
 			float green = 191.0f / 255.0f;
 			float blue = 255.0f / 255.0f;
-			std::vector<float> color = { red, green, blue };
-			return Materials(2500.0f, color, MaterialType::Glass);
+			std::array<float, 3> color = { red, green, blue };
+			return Materials(2500.0f, color, MaterialType::Glass, 0.3f);
 		}
 
 		static Materials CreateAluminum() {
 			float red = 176.0f / 255.0f;
 			float green = 196.0f / 255.0f;
 			float blue = 222.0f / 255.0f;
-			std::vector<float> color = { red, green, blue };
-			return Materials(2700.0f, color, MaterialType::Aluminum);
+			std::array<float, 3> color = { red, green, blue };
+			return Materials(2700.0f, color, MaterialType::Aluminum, 0.35f);
+		}
+	};
+
+	// Interns materials so bodies refer to a small shared table by id instead of carrying a copy each
+	class MaterialTable {
+	public:
+
+		const Materials& Get(int id) const {
+			return materials[id];
 		}
-	};
\ No newline at end of file
+
+		size_t Size() const {
+			return materials.size();
+		}
+
+		int Intern(const Materials& material) {
+			for (size_t i = 0; i < materials.size(); i++) {
+				const Materials& known = materials[i];
+				if (known.MType == material.MType && known.Density == material.Density && known.Friction == material.Friction && known.Color == material.Color) {
+					return static_cast<int>(i);
+				}
+			}
+			materials.push_back(material);
+			return static_cast<int>(materials.size()) - 1;
+		}
+
+	private:
+		std::vector<Materials> materials;
+	};
@@ -0,0 +1,573 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <AABB.h>
+#include <Bodies.h>
+#include <BodyStore.h>
+#include <Liquids.h>
+#include <Scratch.h>
+#include <Vector.h>
+#include <WorkerPool.h>
+
+// Resolution and stiffness of a particle fluid
+struct FluidSettings {
+	float ParticleSpacing = 0.1f;      // rest distance between neighbouring particles [m]
+	float SmoothingRatio = 2.0f;       // kernel radius in particle spacings
+	float SoundSpeed = 20.0f;          // stiffness of the pressure response, and the speed limit of a particle [m/s]
+	float ArtificialViscosity = 0.01f; // kinematic viscosity added to the liquid's own for stability [m^2/s]
+	int MaxSubsteps = 8;
+};
+
+// Weakly compressible smoothed-particle hydrodynamics. Particles live in structure-of-arrays like
+// the bodies and are sorted by cell of a uniform grid, one kernel radius wide, before every
+// substep. The neighbours of a particle are then three contiguous runs of the sorted arrays, one
+// per row of the 3x3 cells around it. Density, pressure and viscosity passes each write only the
+// particles of their own range, so they split over the worker pool and give the same result for
+// any worker count.
+//
+// Bodies act as walls: a particle near a body's surface gets the density and pressure push of
+// the particles that would fill the body at rest, and is moved out of the body when it gets in.
+// The forces back on the bodies are applied by World.
+class ParticleFluid {
+public:
+	std::vector<FlatVector> Positions;
+	std::vector<FlatVector> Velocities;
+	std::vector<float> Densities;
+	std::vector<float> Pressures;
+	std::vector<FlatVector> Accelerations;
+
+	explicit ParticleFluid(const Liquids& liquid = Liquids::CreateBodyOfWater({}), const FluidSettings& settings = FluidSettings()) {
+		SetLiquid(liquid);
+		SetSettings(settings);
+	}
+
+	// Density and viscosity of the fluid
+	void SetLiquid(const Liquids& liquid) {
+		restDensity = liquid.Density;
+		liquidViscosity = liquid.Viscosity;
+		UpdateConstants();
+	}
+	// The spacing also sets the mass of every particle, so change it before adding any
+	void SetSettings(const FluidSettings& newSettings) {
+		settings = newSettings;
+		settings.ParticleSpacing = std::max(settings.ParticleSpacing, 1e-4f);
+		settings.SmoothingRatio = std::max(settings.SmoothingRatio, 1.0f);
+		settings.SoundSpeed = std::max(settings.SoundSpeed, 1e-3f);
+		settings.MaxSubsteps = std::max(settings.MaxSubsteps, 1);
+		UpdateConstants();
+	}
+	const FluidSettings& GetSettings() const {
+		return settings;
+	}
+
+	size_t Size() const {
+		return Positions.size();
+	}
+	float GetRestDensity() const {
+		return restDensity;
+	}
+	float GetParticleMass() const {
+		return particleMass;
+	}
+	// Area of liquid one particle stands for at rest density
+	float GetParticleArea() const {
+		return particleMass / restDensity;
+	}
+	float GetSmoothingRadius() const {
+		return smoothingRadius;
+	}
+	// Distance kept between a particle and the surface of a body
+	float GetParticleRadius() const {
+		return 0.5f * settings.ParticleSpacing;
+	}
+	// Box around every particle
+	AABB GetBounds() const {
+		return bounds.Fattened(travel);
+	}
+
+	void Reserve(size_t count) {
+		Positions.reserve(count);
+		Velocities.reserve(count);
+		Densities.reserve(count);
+		Pressures.reserve(count);
+		Accelerations.reserve(count);
+	}
+
+	void AddParticle(const FlatVector& position, const FlatVector& velocity = FlatVector(0.0f, 0.0f)) {
+		Positions.push_back(position);
+		Velocities.push_back(velocity);
+		Densities.push_back(restDensity);
+		Pressures.push_back(0.0f);
+		Accelerations.push_back(FlatVector(0.0f, 0.0f));
+		cellsValid = false;
+	}
+
+	// Fills [min, max] with particles at rest spacing, returns how many were added
+	int AddBlock(const FlatVector& min, const FlatVector& max, const FlatVector& velocity = FlatVector(0.0f, 0.0f)) {
+		float spacing = settings.ParticleSpacing;
+		int columns = static_cast<int>(std::floor((max.x - min.x) / spacing));
+		int rows = static_cast<int>(std::floor((max.y - min.y) / spacing));
+		if (columns <= 0 || rows <= 0) return 0;
+
+		Reserve(Size() + static_cast<size_t>(columns) * rows);
+		for (int row = 0; row < rows; row++) {
+			for (int column = 0; column < columns; column++) {
+				AddParticle(min + FlatVector((column + 0.5f) * spacing, (row + 0.5f) * spacing), velocity);
+			}
+		}
+		return columns * rows;
+	}
+
+	// Call after Positions and Velocities were replaced, as by RestoreCheckpoint: the other arrays
+	// follow their size and the next Step sorts the particles again
+	void StateChanged() {
+		Densities.resize(Positions.size(), restDensity);
+		Pressures.resize(Positions.size(), 0.0f);
+		Accelerations.resize(Positions.size(), FlatVector(0.0f, 0.0f));
+		cellsValid = false;
+	}
+
+	void Clear() {
+		Positions.clear();
+		Velocities.clear();
+		Densities.clear();
+		Pressures.clear();
+		Accelerations.clear();
+		cellsValid = false;
+	}
+
+	// Advances the particles by deltaTime in as many substeps as the sound speed needs. The bodies'
+	// cached world shapes must be up to date.
+	void Step(float deltaTime, const FlatVector& gravity, const BodyStore& bodies, WorkerPool& pool) {
+		if (Positions.empty() || deltaTime <= 0.0f) return;
+
+		// Pressure waves may cross at most 0.4 kernel radii per substep
+		int substeps = static_cast<int>(std::ceil(deltaTime * settings.SoundSpeed / (0.4f * smoothingRadius)));
+		substeps = std::min(std::max(substeps, 1), settings.MaxSubsteps);
+		float substepTime = deltaTime / substeps;
+
+		if (!cellsValid) {
+			BuildCells();
+		}
+		FindNearBodies(bodies, travel + settings.SoundSpeed * deltaTime + smoothingRadius);
+
+		for (int substep = 0; substep < substeps; substep++) {
+			if (travel > 0.0f) {
+				BuildCells(); // not when particles were just added and sorted above
+			}
+			FindWalls(bodies);
+			ParallelFor(pool, [this](int begin, int end) { ComputeDensities(begin, end); });
+			ParallelFor(pool, [this, &gravity](int begin, int end) { ComputeAccelerations(begin, end, gravity); });
+			ParallelFor(pool, [this, substepTime](int begin, int end) { Integrate(begin, end, substepTime); });
+			travel += settings.SoundSpeed * substepTime;
+			CollideBodies(bodies);
+		}
+	}
+
+	// Adds a velocity change to every particle, such as the reaction to the forces on bodies, with
+	// the speed held below the sound speed as in the integration
+	void AddVelocities(const std::vector<FlatVector>& changes) {
+		float maxSpeedSquared = settings.SoundSpeed * settings.SoundSpeed;
+
+		for (size_t i = 0; i < Velocities.size(); i++) {
+			FlatVector velocity = Velocities[i] + changes[i];
+			float speedSquared = velocity.x * velocity.x + velocity.y * velocity.y;
+			if (speedSquared > maxSpeedSquared) {
+				velocity = velocity * (settings.SoundSpeed / std::sqrt(speedSquared));
+			}
+			Velocities[i] = velocity;
+		}
+	}
+
+	// Indices of the particles inside box, valid until the next Step or AddParticle
+	void Query(const AABB& box, std::vector<int>& particles) const {
+		particles.clear();
+		ForEachParticleIn(box, [&particles](int particle) { particles.push_back(particle); });
+	}
+
+private:
+	static constexpr int MinParticlesPerWorker = 2048;
+	static constexpr int WallSamples = 32;
+
+	FluidSettings settings;
+	float restDensity = 997.0f;
+	float liquidViscosity = 0.0f;
+	float kinematicViscosity = 0.0f;
+	float smoothingRadius = 0.2f;
+	float particleMass = 1.0f;
+	float kernelScale = 0.0f;        // Wendland C2 kernel (1 - q)^4 (1 + 4q), q = r / h
+	float gradientScale = 0.0f;      // its gradient over the offset, (1 - q)^3
+
+	// Density and pressure push a particle gets from a flat wall at a distance from 0 to a kernel
+	// radius, from the rest lattice continued past the wall
+	std::array<float, WallSamples + 2> wallDensityTable;
+	std::array<float, WallSamples + 2> wallPushTable;
+
+	// Cell list: particles are sorted by cell, the cells of a row are consecutive and cellStart
+	// holds the first particle of every cell plus one past the last. Since the sort no particle moved
+	// further than travel, as speeds are held below the sound speed.
+	AABB bounds;
+	float travel = 0.0f;
+	FlatVector gridOrigin;
+	float invCellSize = 5.0f;
+	int gridWidth = 0;
+	int gridHeight = 0;
+	bool cellsValid = false;
+	std::vector<int> cellStart;
+	std::vector<int> cellFill;
+	std::vector<int> cellKeys;
+	std::vector<int> sortedKeys;
+	std::vector<FlatVector> sortedPositions;
+	std::vector<FlatVector> sortedVelocities;
+
+	std::vector<int> nearBodies;
+	std::vector<AABB> nearBodyBoxes;
+	std::vector<float> wallDensities;
+	std::vector<FlatVector> wallPushes;
+
+	void UpdateConstants() {
+		float spacing = settings.ParticleSpacing;
+		float h = spacing * settings.SmoothingRatio;
+		smoothingRadius = h;
+		kernelScale = 7.0f / (3.14159265f * h * h);
+		gradientScale = 140.0f / (3.14159265f * h * h * h * h);
+		kinematicViscosity = liquidViscosity / restDensity + settings.ArtificialViscosity;
+
+		// The mass that gives rest density on a square lattice of the spacing, so a block added by
+		// AddBlock starts at rest instead of expanding or collapsing
+		int reach = static_cast<int>(std::ceil(settings.SmoothingRatio));
+		float latticeSum = 0.0f;
+		for (int y = -reach; y <= reach; y++) {
+			for (int x = -reach; x <= reach; x++) {
+				latticeSum += DensityKernel((x * x + y * y) * spacing * spacing);
+			}
+		}
+		particleMass = restDensity / latticeSum;
+
+		// Rows of the lattice behind a wall start half a spacing past its surface, where a particle
+		// resting against the wall would see its next row
+		for (int sample = 0; sample <= WallSamples + 1; sample++) {
+			float distance = h * std::min(sample, WallSamples) / WallSamples;
+			float density = 0.0f;
+			float push = 0.0f;
+			for (int row = 0; (row + 0.5f) * spacing < h; row++) {
+				float depth = distance + (row + 0.5f) * spacing;
+				for (int x = -reach; x <= reach; x++) {
+					float distanceSquared = x * x * spacing * spacing + depth * depth;
+					density += DensityKernel(distanceSquared);
+					float q = std::sqrt(distanceSquared) / h;
+					if (q < 1.0f) {
+						push += gradientScale * (1.0f - q) * (1.0f - q) * (1.0f - q) * depth;
+					}
+				}
+			}
+			wallDensityTable[sample] = particleMass * (sample > WallSamples ? 0.0f : density);
+			wallPushTable[sample] = particleMass * (sample > WallSamples ? 0.0f : push);
+		}
+		cellsValid = false;
+	}
+
+	float DensityKernel(float distanceSquared) const {
+		float q = std::sqrt(distanceSquared) / smoothingRadius;
+		if (q >= 1.0f) return 0.0f;
+		float falloff = (1.0f - q) * (1.0f - q);
+		return kernelScale * falloff * falloff * (1.0f + 4.0f * q);
+	}
+
+	template <typename Task>
+	void ParallelFor(WorkerPool& pool, const Task& range) {
+		int count = static_cast<int>(Positions.size());
+		int workers = std::min(pool.GetWorkerCount(), std::max(1, count / MinParticlesPerWorker));
+
+		auto task = [&range, count, workers](int worker) {
+			if (worker >= workers) return;
+			int begin = static_cast<int>(static_cast<long long>(count) * worker / workers);
+			int end = static_cast<int>(static_cast<long long>(count) * (worker + 1) / workers);
+			range(begin, end);
+		};
+		if (workers > 1) {
+			pool.Run(task);
+		}
+		else {
+			task(0);
+		}
+	}
+
+	int CellCoord(float offset, int cells) const {
+		float cell = std::floor(offset * invCellSize);
+		if (!(cell > 0.0f)) return 0; // also NaN
+		return cell < cells - 1 ? static_cast<int>(cell) : cells - 1;
+	}
+
+	// Calls visit(particle) for every particle inside box
+	template <typename Visit>
+	void ForEachParticleIn(const AABB& box, const Visit& visit) const {
+		if (!cellsValid || !AABB::Overlap(box, GetBounds())) return;
+
+		int minX = CellCoord(box.Min.x - travel - gridOrigin.x, gridWidth);
+		int minY = CellCoord(box.Min.y - travel - gridOrigin.y, gridHeight);
+		int maxX = CellCoord(box.Max.x + travel - gridOrigin.x, gridWidth);
+		int maxY = CellCoord(box.Max.y + travel - gridOrigin.y, gridHeight);
+		for (int y = minY; y <= maxY; y++) {
+			int end = cellStart[y * gridWidth + maxX + 1];
+			for (int p = cellStart[y * gridWidth + minX]; p < end; p++) {
+				const FlatVector& position = Positions[p];
+				if (position.x >= box.Min.x && position.x <= box.Max.x && position.y >= box.Min.y && position.y <= box.Max.y) {
+					visit(p);
+				}
+			}
+		}
+	}
+
+	// Counting sort of the particles by cell over a grid that just covers them
+	void BuildCells() {
+		size_t count = Positions.size();
+
+		FlatVector min = Positions[0];
+		FlatVector max = Positions[0];
+		for (const auto& position : Positions) {
+			min.x = std::min(min.x, position.x);
+			min.y = std::min(min.y, position.y);
+			max.x = std::max(max.x, position.x);
+			max.y = std::max(max.y, position.y);
+		}
+		bounds = AABB(min, max);
+		travel = 0.0f;
+
+		// Cells no smaller than a kernel radius, and coarser when a few particles fly far off so the
+		// grid stays within a few cells per particle
+		float width = max.x - min.x;
+		float height = max.y - min.y;
+		double cellLimit = 4.0 * count + 4096.0;
+		float cellSize = smoothingRadius;
+		if ((width / cellSize + 1.0) * (height / cellSize + 1.0) > cellLimit) {
+			cellSize = std::max(smoothingRadius, 2.0f * static_cast<float>(std::sqrt(static_cast<double>(width) * height / cellLimit)));
+		}
+		invCellSize = 1.0f / cellSize;
+		gridOrigin = min;
+		gridWidth = static_cast<int>(width * invCellSize) + 1;
+		gridHeight = static_cast<int>(height * invCellSize) + 1;
+
+		// Reserved up to the limit, so a splash reaching further than before does not allocate again
+		size_t cellCount = static_cast<size_t>(gridWidth) * gridHeight;
+		size_t cellCapacity = std::max(cellCount, static_cast<size_t>(cellLimit)) + 1;
+		cellStart.reserve(cellCapacity);
+		cellFill.reserve(cellCapacity);
+		cellStart.assign(cellCount + 1, 0);
+		cellKeys.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			int key = CellCoord(Positions[i].y - min.y, gridHeight) * gridWidth + CellCoord(Positions[i].x - min.x, gridWidth);
+			cellKeys[i] = key;
+			cellStart[key + 1]++;
+		}
+		for (size_t cell = 0; cell < cellCount; cell++) {
+			cellStart[cell + 1] += cellStart[cell];
+		}
+
+		cellFill.assign(cellStart.begin(), cellStart.end() - 1);
+		sortedPositions.resize(count);
+		sortedVelocities.resize(count);
+		sortedKeys.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			int target = cellFill[cellKeys[i]]++;
+			sortedPositions[target] = Positions[i];
+			sortedVelocities[target] = Velocities[i];
+			sortedKeys[target] = cellKeys[i];
+		}
+		Positions.swap(sortedPositions);
+		Velocities.swap(sortedVelocities);
+		cellKeys.swap(sortedKeys);
+		cellsValid = true;
+	}
+
+	// Calls visit(j, offset, distanceSquared) for every particle j within a kernel radius of particle
+	// i, i itself included
+	template <typename Visit>
+	void ForEachNeighbour(int i, const Visit& visit) const {
+		float radiusSquared = smoothingRadius * smoothingRadius;
+		const FlatVector& position = Positions[i];
+		int cellX = cellKeys[i] % gridWidth;
+		int cellY = cellKeys[i] / gridWidth;
+		int minX = std::max(cellX - 1, 0);
+		int maxX = std::min(cellX + 1, gridWidth - 1);
+
+		for (int y = std::max(cellY - 1, 0); y <= std::min(cellY + 1, gridHeight - 1); y++) {
+			int end = cellStart[y * gridWidth + maxX + 1];
+			for (int j = cellStart[y * gridWidth + minX]; j < end; j++) {
+				FlatVector offset = position - Positions[j];
+				float distanceSquared = offset.x * offset.x + offset.y * offset.y;
+				if (distanceSquared < radiusSquared) {
+					visit(j, offset, distanceSquared);
+				}
+			}
+		}
+	}
+
+	// Density from the neighbours and walls, and pressure from how far it is above rest density.
+	// Below rest density the pressure stays zero, so the free surface does not pull particles into clumps.
+	void ComputeDensities(int begin, int end) {
+		float invRadius = 1.0f / smoothingRadius;
+		float stiffness = settings.SoundSpeed * settings.SoundSpeed;
+
+		for (int i = begin; i < end; i++) {
+			float density = 0.0f;
+			ForEachNeighbour(i, [&](int, const FlatVector&, float distanceSquared) {
+				float q = std::sqrt(distanceSquared) * invRadius;
+				float falloff = (1.0f - q) * (1.0f - q);
+				density += falloff * falloff * (1.0f + 4.0f * q);
+			});
+			density = density * kernelScale * particleMass + wallDensities[i];
+			Densities[i] = density;
+			Pressures[i] = std::max(0.0f, stiffness * (density - restDensity));
+		}
+	}
+
+	// Pressure and viscosity both use the kernel gradient. The viscosity term is Monaghan's, which
+	// also damps particles closing in on each other, and walls push like particles at the same
+	// pressure and density.
+	void ComputeAccelerations(int begin, int end, const FlatVector& gravity) {
+		float invRadius = 1.0f / smoothingRadius;
+		float softening = 0.01f * smoothingRadius * smoothingRadius;
+
+		for (int i = begin; i < end; i++) {
+			float pressureTerm = Pressures[i] / (Densities[i] * Densities[i]);
+			const FlatVector& velocity = Velocities[i];
+			FlatVector pressureAcceleration(0.0f, 0.0f);
+			FlatVector viscosityAcceleration(0.0f, 0.0f);
+
+			ForEachNeighbour(i, [&](int j, const FlatVector& offset, float distanceSquared) {
+				if (distanceSquared < 1e-12f) return; // itself, or a particle on top of it
+				float distance = std::sqrt(distanceSquared);
+				float falloff = 1.0f - distance * invRadius;
+
+				float gradient = falloff * falloff * falloff;
+
+				float pressure = pressureTerm + Pressures[j] / (Densities[j] * Densities[j]);
+				pressureAcceleration += offset * (pressure * gradient);
+				float closing = FlatVector::Dot(velocity - Velocities[j], offset);
+				viscosityAcceleration += offset * (closing * gradient / (Densities[j] * (distanceSquared + softening)));
+			});
+			Accelerations[i] = gravity + pressureAcceleration * (particleMass * gradientScale)
+				- viscosityAcceleration * (8.0f * kinematicViscosity * particleMass * gradientScale)
+				+ wallPushes[i] * (2.0f * pressureTerm);
+		}
+	}
+
+	// Symplectic Euler, with the speed held below the sound speed so a stray particle cannot skip
+	// past its neighbours in one substep
+	void Integrate(int begin, int end, float time) {
+		float maxSpeedSquared = settings.SoundSpeed * settings.SoundSpeed;
+
+		for (int i = begin; i < end; i++) {
+			FlatVector velocity = Velocities[i] + Accelerations[i] * time;
+			float speedSquared = velocity.x * velocity.x + velocity.y * velocity.y;
+			if (speedSquared > maxSpeedSquared) {
+				velocity = velocity * (settings.SoundSpeed / std::sqrt(speedSquared));
+			}
+			Velocities[i] = velocity;
+			Positions[i] += velocity * time;
+		}
+	}
+
+	// Bodies close enough to the fluid to be reached by a particle's kernel within this step
+	void FindNearBodies(const BodyStore& bodies, float margin) {
+		AABB reach = bounds.Fattened(margin);
+		nearBodies.clear();
+		nearBodyBoxes.clear();
+		ReserveScratch(nearBodies, bodies.Size());
+		ReserveScratch(nearBodyBoxes, bodies.Size());
+		for (int body = 0; body < static_cast<int>(bodies.Size()); body++) {
+			AABB box = bodies.GetAABB(body);
+			if (AABB::Overlap(box, reach)) {
+				nearBodies.push_back(body);
+				nearBodyBoxes.push_back(box);
+			}
+		}
+	}
+
+	// Density and pressure push from every body surface within a kernel radius of a particle. Pushes
+	// add up, so a particle in a corner feels both walls, but density takes the densest wall: the
+	// lattices behind two walls overlap past a corner and would count it twice.
+	void FindWalls(const BodyStore& bodies) {
+		wallDensities.assign(Positions.size(), 0.0f);
+		wallPushes.assign(Positions.size(), FlatVector(0.0f, 0.0f));
+
+		for (size_t n = 0; n < nearBodies.size(); n++) {
+			int body = nearBodies[n];
+			ForEachParticleIn(nearBodyBoxes[n].Fattened(smoothingRadius), [&](int p) {
+				FlatVector normal;
+				float distance;
+				if (!SurfaceDistance(bodies, body, Positions[p], smoothingRadius, normal, distance)) return;
+
+				float sample = std::max(distance, 0.0f) / smoothingRadius * WallSamples;
+				int index = static_cast<int>(sample);
+				float blend = sample - index;
+				wallDensities[p] = std::max(wallDensities[p], wallDensityTable[index] + (wallDensityTable[index + 1] - wallDensityTable[index]) * blend);
+				wallPushes[p] += normal * (wallPushTable[index] + (wallPushTable[index + 1] - wallPushTable[index]) * blend);
+			});
+		}
+	}
+
+	// Moves particles that ended up inside a body back to its surface and removes the part of their
+	// velocity, relative to the body, that points into it. Bodies are not pushed back here.
+	void CollideBodies(const BodyStore& bodies) {
+		float radius = GetParticleRadius();
+
+		for (size_t n = 0; n < nearBodies.size(); n++) {
+			int body = nearBodies[n];
+			const FlatVector& center = bodies.Positions[body];
+			float spin = bodies.RotationalVelocities[body];
+
+			ForEachParticleIn(nearBodyBoxes[n].Fattened(radius), [&](int p) {
+				FlatVector normal;
+				float distance;
+				if (!SurfaceDistance(bodies, body, Positions[p], radius, normal, distance)) return;
+
+				Positions[p] += normal * (radius - distance);
+
+				FlatVector arm = Positions[p] - center;
+				FlatVector surfaceVelocity = bodies.LinearVelocities[body] + FlatVector(-arm.y * spin, arm.x * spin);
+				float approach = FlatVector::Dot(Velocities[p] - surfaceVelocity, normal);
+				if (approach < 0.0f) {
+					Velocities[p] -= normal * approach;
+				}
+			});
+		}
+	}
+
+	// Signed distance from a body's surface to the point, negative inside, and the outward normal of
+	// the nearest face, when it is below limit. Polygons use the face the point is least deep behind,
+	// which underestimates the distance past a corner.
+	static bool SurfaceDistance(const BodyStore& bodies, int body, const FlatVector& point, float limit, FlatVector& normal, float& distance) {
+		if (bodies.GetShape(body).Type == Bodies::ShapeType::Circle) {
+			FlatVector offset = point - bodies.Positions[body];
+			float radius = bodies.Radii[body];
+			float reach = radius + limit;
+			float distanceSquared = FlatVector::DistanceSquared(offset);
+			if (distanceSquared >= reach * reach) return false;
+
+			float length = std::sqrt(distanceSquared);
+			normal = length > 1e-6f ? offset / length : FlatVector(0.0f, 1.0f);
+			distance = length - radius;
+			return true;
+		}
+
+		FlatVectorSpan vertices = bodies.GetWorldVertices(body);
+		FlatVectorSpan normals = bodies.GetWorldNormals(body);
+		distance = -std::numeric_limits<float>::max();
+		for (int k = 0; k < vertices.size(); k++) {
+			float separation = FlatVector::Dot(point - vertices[k], normals[k]);
+			if (separation >= limit) return false;
+			if (separation > distance) {
+				distance = separation;
+				normal = normals[k];
+			}
+		}
+		return true;
+	}
+};
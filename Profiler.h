@@ -0,0 +1,265 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <cstdint>
+
+// Per-phase step timing. Define PHYSICS_PROFILING to record; without it the PHYSICS_PROFILE macros
+// expand to nothing and GetStats reports no samples.
+#ifdef PHYSICS_PROFILING
+#define PHYSICS_PROFILE(statement) statement
+#define PHYSICS_PROFILE_CONCAT_INNER(a, b) a##b
+#define PHYSICS_PROFILE_CONCAT(a, b) PHYSICS_PROFILE_CONCAT_INNER(a, b)
+#define PHYSICS_PROFILE_SCOPE(profiler, phase) ProfileScope PHYSICS_PROFILE_CONCAT(profileScope, __LINE__)(profiler, phase)
+#else
+#define PHYSICS_PROFILE(statement)
+#define PHYSICS_PROFILE_SCOPE(profiler, phase)
+#endif
+
+enum class ProfilePhase {
+	Step,
+	Commands,
+	IntegrateVelocities,
+	BroadPhase,
+	NarrowPhase,
+	Collide,       // summed over narrow-phase workers
+	ContactPoints, // summed over narrow-phase workers
+	Solver,
+	IntegratePositions,
+	ParticleFluid,
+	Liquids,
+	Sleeping,
+	Count
+};
+
+enum class ProfileCounter {
+	PairsTested,
+	CircleRejections, // circle pairs rejected by the batched distance test
+	SatEarlyOuts,     // other pairs separated by Collide
+	Contacts,
+	Count
+};
+
+static const int ProfilePhaseCount = static_cast<int>(ProfilePhase::Count);
+static const int ProfileCounterCount = static_cast<int>(ProfileCounter::Count);
+
+struct PhaseStats {
+	float LastMs = 0.0f;
+	float MeanMs = 0.0f;
+	float P50Ms = 0.0f, P95Ms = 0.0f, P99Ms = 0.0f;
+	float MaxMs = 0.0f;
+};
+
+// Timings over the last Profiler::Window steps; counters of the last step and their window mean
+struct WorldStats {
+	int Samples = 0;
+	std::array<PhaseStats, ProfilePhaseCount> Phases;
+	std::array<uint64_t, ProfileCounterCount> LastCounters{};
+	std::array<float, ProfileCounterCount> MeanCounters{};
+
+	const PhaseStats& Get(ProfilePhase phase) const {
+		return Phases[static_cast<int>(phase)];
+	}
+	uint64_t GetLast(ProfileCounter counter) const {
+		return LastCounters[static_cast<int>(counter)];
+	}
+};
+
+// What one narrow-phase worker measured, merged into the profiler after the workers finished
+struct WorkerProfile {
+	std::array<int64_t, ProfilePhaseCount> Nanoseconds{};
+	std::array<uint64_t, ProfileCounterCount> Counters{};
+	int64_t Begin = 0, End = 0;
+
+	void Reset() {
+		Nanoseconds.fill(0);
+		Counters.fill(0);
+		Begin = End = 0;
+	}
+	void Count(ProfileCounter counter, uint64_t amount = 1) {
+		Counters[static_cast<int>(counter)] += amount;
+	}
+};
+
+class Profiler {
+public:
+	static constexpr int Window = 240;
+
+	Profiler() : epoch(std::chrono::steady_clock::now()), cursor(0), samples(0), tracing(false), traceCapacity(0) {
+		current.fill(0);
+		currentCounters.fill(0);
+		for (auto& history : phaseHistory) history.fill(0);
+		for (auto& history : counterHistory) history.fill(0);
+	}
+
+	static bool IsEnabled() {
+#ifdef PHYSICS_PROFILING
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Nanoseconds since the profiler was created
+	int64_t Now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	void BeginStep() {
+		current.fill(0);
+		currentCounters.fill(0);
+	}
+
+	void EndStep() {
+		for (int p = 0; p < ProfilePhaseCount; p++) phaseHistory[p][cursor] = current[p];
+		for (int c = 0; c < ProfileCounterCount; c++) counterHistory[c][cursor] = currentCounters[c];
+		cursor = (cursor + 1) % Window;
+		samples = std::min(samples + 1, Window);
+	}
+
+	void AddTime(ProfilePhase phase, int64_t begin, int64_t end, int thread = 0) {
+		current[static_cast<int>(phase)] += end - begin;
+		Trace(phase, begin, end, thread);
+	}
+
+	void Count(ProfileCounter counter, uint64_t amount = 1) {
+		currentCounters[static_cast<int>(counter)] += amount;
+	}
+
+	// Adds the summed phases and counters of a worker; its span shows up in the trace as NarrowPhase
+	void MergeWorker(const WorkerProfile& worker, int thread) {
+		for (int p = 0; p < ProfilePhaseCount; p++) current[p] += worker.Nanoseconds[p];
+		for (int c = 0; c < ProfileCounterCount; c++) currentCounters[c] += worker.Counters[c];
+		Trace(ProfilePhase::NarrowPhase, worker.Begin, worker.End, thread);
+	}
+
+	WorldStats GetStats() const {
+		WorldStats stats;
+		stats.Samples = samples;
+		if (samples == 0) return stats;
+
+		int last = (cursor + Window - 1) % Window;
+		std::vector<int64_t> sorted(samples);
+		for (int p = 0; p < ProfilePhaseCount; p++) {
+			std::copy(phaseHistory[p].begin(), phaseHistory[p].begin() + samples, sorted.begin());
+			std::sort(sorted.begin(), sorted.end());
+
+			int64_t total = 0;
+			for (int64_t value : sorted) total += value;
+
+			PhaseStats& phase = stats.Phases[p];
+			phase.LastMs = ToMs(phaseHistory[p][last]);
+			phase.MeanMs = ToMs(total) / samples;
+			phase.P50Ms = ToMs(Percentile(sorted, 0.50f));
+			phase.P95Ms = ToMs(Percentile(sorted, 0.95f));
+			phase.P99Ms = ToMs(Percentile(sorted, 0.99f));
+			phase.MaxMs = ToMs(sorted.back());
+		}
+		for (int c = 0; c < ProfileCounterCount; c++) {
+			uint64_t total = 0;
+			for (int s = 0; s < samples; s++) total += counterHistory[c][s];
+			stats.LastCounters[c] = counterHistory[c][last];
+			stats.MeanCounters[c] = static_cast<float>(total) / samples;
+		}
+		return stats;
+	}
+
+	// Records every timed scope from now on, up to maxEvents, for WriteChromeTrace
+	void StartTrace(size_t maxEvents = 100000) {
+		traceEvents.clear();
+		traceEvents.reserve(maxEvents);
+		traceCapacity = maxEvents;
+		tracing = true;
+	}
+	void StopTrace() {
+		tracing = false;
+	}
+
+	// Trace Event Format, viewable in chrome://tracing or Perfetto
+	void WriteChromeTrace(std::ostream& out) const {
+		out << "{\"traceEvents\":[";
+		for (size_t i = 0; i < traceEvents.size(); i++) {
+			const TraceEvent& event = traceEvents[i];
+			out << (i ? ",\n" : "\n")
+				<< "{\"name\":\"" << GetPhaseName(event.Phase) << "\",\"cat\":\"physics\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.Thread
+				<< ",\"ts\":" << event.Begin / 1000.0 << ",\"dur\":" << (event.End - event.Begin) / 1000.0 << "}";
+		}
+		out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	}
+	bool WriteChromeTrace(const std::string& path) const {
+		std::ofstream out(path);
+		if (!out) return false;
+		WriteChromeTrace(out);
+		return static_cast<bool>(out);
+	}
+
+	static const char* GetPhaseName(ProfilePhase phase) {
+		static const char* names[ProfilePhaseCount] = {
+			"Step", "Commands", "IntegrateVelocities", "BroadPhase", "NarrowPhase", "Collide", "ContactPoints",
+			"Solver", "IntegratePositions", "ParticleFluid", "Liquids", "Sleeping"
+		};
+		return names[static_cast<int>(phase)];
+	}
+	static const char* GetCounterName(ProfileCounter counter) {
+		static const char* names[ProfileCounterCount] = { "PairsTested", "CircleRejections", "SatEarlyOuts", "Contacts" };
+		return names[static_cast<int>(counter)];
+	}
+
+private:
+	struct TraceEvent {
+		ProfilePhase Phase;
+		int Thread;
+		int64_t Begin, End;
+	};
+
+	std::chrono::steady_clock::time_point epoch;
+	std::array<int64_t, ProfilePhaseCount> current;
+	std::array<uint64_t, ProfileCounterCount> currentCounters;
+	std::array<std::array<int64_t, Window>, ProfilePhaseCount> phaseHistory;
+	std::array<std::array<uint64_t, Window>, ProfileCounterCount> counterHistory;
+	int cursor;
+	int samples;
+	bool tracing;
+	size_t traceCapacity;
+	std::vector<TraceEvent> traceEvents;
+
+	void Trace(ProfilePhase phase, int64_t begin, int64_t end, int thread) {
+		if (tracing && traceEvents.size() < traceCapacity) {
+			traceEvents.push_back(TraceEvent{ phase, thread, begin, end });
+		}
+	}
+
+	static float ToMs(int64_t nanoseconds) {
+		return static_cast<float>(nanoseconds) * 1e-6f;
+	}
+
+	static int64_t Percentile(const std::vector<int64_t>& sorted, float fraction) {
+		size_t rank = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5f);
+		return sorted[std::min(rank, sorted.size() - 1)];
+	}
+};
+
+// Adds the time until the end of the enclosing scope to a phase
+class ProfileScope {
+public:
+	ProfileScope(Profiler& profiler, ProfilePhase phase) : profiler(profiler), phase(phase), begin(profiler.Now()) {
+		if (phase == ProfilePhase::Step) profiler.BeginStep();
+	}
+	~ProfileScope() {
+		profiler.AddTime(phase, begin, profiler.Now());
+		if (phase == ProfilePhase::Step) profiler.EndStep();
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	Profiler& profiler;
+	ProfilePhase phase;
+	int64_t begin;
+};
@@ -0,0 +1,730 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <World.h>
+
+// Replay files hold one frame per recorded step. Positions, velocities and rotations are quantised to
+// integers. A keyframe stores them outright; every other frame stores only the difference from a
+// prediction made from the two frames before it (constant velocity for positions and rotations,
+// unchanged velocities). Bodies whose every difference is zero are skipped with a run length, so
+// resting bodies cost almost nothing; a body whose differences all fit in four bits takes three bytes,
+// any other body a component mask and zigzag varints. Closing the recorder appends an index with the
+// offset and keyframe of every frame.
+//
+//   header   "PE2DRPL1", version, position, velocity and rotation quanta
+//   frame    payload size, type, step, body count, payload
+//   index    frame count x (offset, keyframe), "PE2DIDX1", index offset, frame count
+
+struct ReplayOptions {
+	float PositionQuantum = 1.0f / 1024.0f; // [m]
+	float VelocityQuantum = 1.0f / 64.0f;   // [m/s], also used for rotational velocity in [rad/s]
+	float RotationQuantum = 1.0f / 4096.0f; // [rad]
+	int KeyframeInterval = 120;             // frames between keyframes, bounds the decoding work of a seek
+	int StepInterval = 1;                   // record every nth step
+	int QueueFrames = 16;                   // captured frames waiting for the writer before frames are dropped
+};
+
+// State of all bodies in one recorded step, indexed like the BodyStore it was taken from
+struct ReplayFrame {
+	uint64_t StepIndex = 0;
+	std::vector<int> Slots; // handle slots, which identify bodies across frames
+	std::vector<FlatVector> Positions;
+	std::vector<FlatVector> LinearVelocities;
+	std::vector<float> Rotations;
+	std::vector<float> RotationalVelocities;
+
+	size_t BodyCount() const {
+		return Positions.size();
+	}
+};
+
+namespace ReplayFormat {
+	static const char Magic[8] = { 'P', 'E', '2', 'D', 'R', 'P', 'L', '1' };
+	static const char IndexMagic[8] = { 'P', 'E', '2', 'D', 'I', 'D', 'X', '1' };
+	static const uint32_t Version = 1;
+	static const size_t HeaderSize = 8 + 4 + 3 * 4;
+	static const size_t FrameHeaderSize = 4 + 1 + 8 + 4;
+	static const size_t IndexEntrySize = 8 + 8;
+	static const size_t TrailerSize = 8 + 8 + 8;
+	static const int Components = 6; // x, y, velocity x, velocity y, rotation, rotational velocity
+
+	enum FrameType : uint8_t {
+		Keyframe = 0,
+		Delta = 1
+	};
+
+	inline void PutBytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		out.insert(out.end(), bytes, bytes + size);
+	}
+	template<class T>
+	inline void Put(std::vector<uint8_t>& out, T value) {
+		PutBytes(out, &value, sizeof(T)); // little endian hosts only
+	}
+	template<class T>
+	inline T Get(const uint8_t* data) {
+		T value;
+		std::memcpy(&value, data, sizeof(T));
+		return value;
+	}
+
+	inline void PutVarint(std::vector<uint8_t>& out, uint64_t value) {
+		while (value >= 0x80) {
+			out.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(value));
+	}
+	inline void PutSigned(std::vector<uint8_t>& out, int64_t value) {
+		PutVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+	}
+	// Advances cursor, or returns false at the end of the data
+	inline bool GetVarint(const uint8_t*& cursor, const uint8_t* end, uint64_t& value) {
+		value = 0;
+		for (int shift = 0; shift < 64 && cursor < end; shift += 7) {
+			uint8_t byte = *cursor++;
+			value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+	inline bool GetSigned(const uint8_t*& cursor, const uint8_t* end, int64_t& value) {
+		uint64_t encoded;
+		if (!GetVarint(cursor, end, encoded)) return false;
+		value = static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1);
+		return true;
+	}
+
+	// Quantised state of one frame, component-major: values[component * bodyCount + body]
+	struct QuantizedState {
+		uint64_t StepIndex = 0;
+		std::vector<int> Slots;
+		std::vector<int64_t> Values;
+
+		size_t BodyCount() const {
+			return Slots.size();
+		}
+		int64_t* Component(int component) {
+			return Values.data() + component * BodyCount();
+		}
+		const int64_t* Component(int component) const {
+			return Values.data() + component * BodyCount();
+		}
+	};
+
+	// Leading byte of a body in a delta frame: a run of unchanged bodies, six packed nibbles, or else the
+	// mask of the components that follow as varints
+	static const uint8_t SkipRun = 0;
+	static const uint8_t Nibbles = 0x80;
+
+	inline bool FitsNibble(int64_t value) {
+		return value >= -8 && value <= 7;
+	}
+	inline int64_t FromNibble(uint8_t nibble) {
+		return static_cast<int64_t>((nibble & 0xf) ^ 8) - 8;
+	}
+
+	// Positions and rotations continue with their last change, velocities stay as they were
+	inline int64_t Predict(int component, int64_t previous, int64_t beforePrevious) {
+		bool extrapolated = component == 0 || component == 1 || component == 4;
+		return extrapolated ? 2 * previous - beforePrevious : previous;
+	}
+}
+
+// Appends the state of every recorded step to a file. Capture only copies the body arrays into a
+// preallocated queue slot; quantising, encoding and writing happen on a background thread. When the
+// writer falls behind by QueueFrames frames, further frames are dropped and counted instead of
+// stalling the physics thread.
+class ReplayRecorder {
+public:
+
+	ReplayRecorder() : file(nullptr), head(0), tail(0), stopping(false), droppedFrames(0), recordedFrames(0), bytesWritten(0) {}
+
+	~ReplayRecorder() {
+		Close();
+	}
+
+	ReplayRecorder(const ReplayRecorder&) = delete;
+	ReplayRecorder& operator=(const ReplayRecorder&) = delete;
+
+	bool Open(const std::string& path, const ReplayOptions& options = ReplayOptions()) {
+		Close();
+		file = std::fopen(path.c_str(), "wb");
+		if (!file) return false;
+
+		Options = options;
+		Options.KeyframeInterval = std::max(1, Options.KeyframeInterval);
+		Options.StepInterval = std::max(1, Options.StepInterval);
+		queue.assign(std::max(2, Options.QueueFrames), CapturedFrame());
+		head = tail = 0;
+		stopping = false;
+		droppedFrames = recordedFrames = bytesWritten = 0;
+		index.clear();
+		framesSinceKeyframe = 0;
+		hasPrevious = false;
+
+		std::vector<uint8_t> header;
+		ReplayFormat::PutBytes(header, ReplayFormat::Magic, 8);
+		ReplayFormat::Put<uint32_t>(header, ReplayFormat::Version);
+		ReplayFormat::Put<float>(header, Options.PositionQuantum);
+		ReplayFormat::Put<float>(header, Options.VelocityQuantum);
+		ReplayFormat::Put<float>(header, Options.RotationQuantum);
+		Write(header);
+
+		writer = std::thread(&ReplayRecorder::WriterLoop, this);
+		return true;
+	}
+
+	bool IsOpen() const {
+		return file != nullptr;
+	}
+
+	// Open, Capture and Close belong to the thread that steps the world. Capture is called between
+	// steps and skips steps that are not a multiple of StepInterval.
+	void Capture(const World& world) {
+		if (!file || world.GetStepCount() % Options.StepInterval != 0) return;
+
+		size_t position = head.load(std::memory_order_relaxed);
+		if (position - tail.load(std::memory_order_acquire) >= queue.size()) {
+			droppedFrames.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		const BodyStore& store = world.GetBodyStore();
+		CapturedFrame& frame = queue[position % queue.size()];
+		frame.StepIndex = world.GetStepCount();
+		frame.LayoutVersion = store.GetLayoutVersion();
+		frame.Slots.assign(store.Slots.begin(), store.Slots.end());
+		frame.Positions.assign(store.Positions.begin(), store.Positions.end());
+		frame.LinearVelocities.assign(store.LinearVelocities.begin(), store.LinearVelocities.end());
+		frame.Rotations.assign(store.Rotations.begin(), store.Rotations.end());
+		frame.RotationalVelocities.assign(store.RotationalVelocities.begin(), store.RotationalVelocities.end());
+		head.store(position + 1, std::memory_order_release);
+		if (position == tail.load(std::memory_order_acquire)) {
+			wakeWriter.notify_one(); // the writer may be waiting on an empty queue
+		}
+	}
+
+	// Writes the remaining frames and the index. The file is playable without the index, the player
+	// then scans the frames once.
+	void Close() {
+		if (!file) return;
+
+		stopping = true;
+		wakeWriter.notify_one();
+		writer.join();
+
+		std::vector<uint8_t> footer;
+		uint64_t indexOffset = bytesWritten;
+		for (const auto& entry : index) {
+			ReplayFormat::Put<uint64_t>(footer, entry.Offset);
+			ReplayFormat::Put<uint64_t>(footer, entry.Keyframe);
+		}
+		ReplayFormat::PutBytes(footer, ReplayFormat::IndexMagic, 8);
+		ReplayFormat::Put<uint64_t>(footer, indexOffset);
+		ReplayFormat::Put<uint64_t>(footer, index.size());
+		Write(footer);
+
+		std::fclose(file);
+		file = nullptr;
+	}
+
+	size_t GetRecordedFrames() const {
+		return recordedFrames.load(std::memory_order_relaxed);
+	}
+	size_t GetDroppedFrames() const {
+		return droppedFrames.load(std::memory_order_relaxed);
+	}
+	uint64_t GetBytesWritten() const {
+		return bytesWritten.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct CapturedFrame {
+		uint64_t StepIndex = 0;
+		uint64_t LayoutVersion = 0;
+		std::vector<int> Slots;
+		std::vector<FlatVector> Positions;
+		std::vector<FlatVector> LinearVelocities;
+		std::vector<float> Rotations;
+		std::vector<float> RotationalVelocities;
+	};
+
+	struct IndexEntry {
+		uint64_t Offset;
+		uint64_t Keyframe; // frame number of the keyframe that decoding starts from
+	};
+
+	ReplayOptions Options;
+	std::FILE* file;
+	std::thread writer;
+	std::vector<CapturedFrame> queue;
+	std::atomic<size_t> head; // next frame Capture fills
+	std::atomic<size_t> tail; // next frame the writer encodes
+	std::atomic<bool> stopping;
+	std::mutex wakeMutex;
+	std::condition_variable wakeWriter;
+	std::atomic<size_t> droppedFrames;
+	std::atomic<size_t> recordedFrames;
+	std::atomic<uint64_t> bytesWritten;
+
+	// Owned by the writer thread
+	std::vector<IndexEntry> index;
+	int framesSinceKeyframe;
+	bool hasPrevious;
+	uint64_t previousLayout;
+	uint64_t lastKeyframe;
+	ReplayFormat::QuantizedState current, previous, beforePrevious;
+	std::vector<uint8_t> buffer;
+
+	void Write(const std::vector<uint8_t>& bytes) {
+		std::fwrite(bytes.data(), 1, bytes.size(), file);
+		bytesWritten.fetch_add(bytes.size(), std::memory_order_relaxed);
+	}
+
+	void WriterLoop() {
+		while (true) {
+			size_t position = tail.load(std::memory_order_relaxed);
+			if (position == head.load(std::memory_order_acquire)) {
+				if (stopping) break;
+				// Capture does not take the lock, so a missed wake-up only costs the timeout
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				wakeWriter.wait_for(lock, std::chrono::milliseconds(2));
+				continue;
+			}
+
+			WriteFrame(queue[position % queue.size()]);
+			tail.store(position + 1, std::memory_order_release);
+		}
+	}
+
+	void Quantize(const CapturedFrame& frame) {
+		size_t count = frame.Positions.size();
+		current.StepIndex = frame.StepIndex;
+		current.Slots.assign(frame.Slots.begin(), frame.Slots.end());
+		current.Values.resize(count * ReplayFormat::Components);
+
+		int64_t* x = current.Component(0);
+		int64_t* y = current.Component(1);
+		int64_t* vx = current.Component(2);
+		int64_t* vy = current.Component(3);
+		int64_t* rotation = current.Component(4);
+		int64_t* spin = current.Component(5);
+		for (size_t i = 0; i < count; i++) {
+			x[i] = std::llround(frame.Positions[i].x / Options.PositionQuantum);
+			y[i] = std::llround(frame.Positions[i].y / Options.PositionQuantum);
+			vx[i] = std::llround(frame.LinearVelocities[i].x / Options.VelocityQuantum);
+			vy[i] = std::llround(frame.LinearVelocities[i].y / Options.VelocityQuantum);
+			rotation[i] = std::llround(frame.Rotations[i] / Options.RotationQuantum);
+			spin[i] = std::llround(frame.RotationalVelocities[i] / Options.VelocityQuantum);
+		}
+	}
+
+	void WriteFrame(const CapturedFrame& frame) {
+		Quantize(frame);
+		size_t count = current.BodyCount();
+
+		// Deltas need the same bodies at the same indices as the frame before
+		bool keyframe = !hasPrevious || frame.LayoutVersion != previousLayout || framesSinceKeyframe >= Options.KeyframeInterval;
+		if (keyframe) {
+			previous = current;
+			beforePrevious = current;
+			framesSinceKeyframe = 0;
+			lastKeyframe = index.size();
+		}
+
+		buffer.clear();
+		ReplayFormat::Put<uint32_t>(buffer, 0); // payload size, filled in below
+		ReplayFormat::Put<uint8_t>(buffer, keyframe ? ReplayFormat::Keyframe : ReplayFormat::Delta);
+		ReplayFormat::Put<uint64_t>(buffer, current.StepIndex);
+		ReplayFormat::Put<uint32_t>(buffer, static_cast<uint32_t>(count));
+
+		if (keyframe) {
+			for (int slot : current.Slots) {
+				ReplayFormat::PutVarint(buffer, static_cast<uint32_t>(slot));
+			}
+			for (int64_t value : current.Values) {
+				ReplayFormat::PutSigned(buffer, value);
+			}
+		}
+		else {
+			EncodeDelta(count);
+		}
+
+		uint32_t payloadSize = static_cast<uint32_t>(buffer.size() - ReplayFormat::FrameHeaderSize);
+		std::memcpy(buffer.data(), &payloadSize, sizeof(payloadSize));
+		index.push_back(IndexEntry{ bytesWritten.load(std::memory_order_relaxed), lastKeyframe });
+		Write(buffer);
+
+		beforePrevious.Values.swap(previous.Values);
+		previous.Values.swap(current.Values);
+		previous.Slots.swap(current.Slots);
+		previous.StepIndex = current.StepIndex;
+		previousLayout = frame.LayoutVersion;
+		hasPrevious = true;
+		framesSinceKeyframe++;
+		recordedFrames.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void EncodeDelta(size_t count) {
+		uint64_t skipped = 0;
+		int64_t residuals[ReplayFormat::Components];
+		for (size_t i = 0; i < count; i++) {
+			uint8_t mask = 0;
+			bool small = true;
+			for (int c = 0; c < ReplayFormat::Components; c++) {
+				residuals[c] = current.Component(c)[i] - ReplayFormat::Predict(c, previous.Component(c)[i], beforePrevious.Component(c)[i]);
+				if (residuals[c] != 0) mask |= 1 << c;
+				small = small && ReplayFormat::FitsNibble(residuals[c]);
+			}
+			if (mask == 0) {
+				skipped++;
+				continue;
+			}
+
+			if (skipped > 0) {
+				buffer.push_back(ReplayFormat::SkipRun);
+				ReplayFormat::PutVarint(buffer, skipped);
+				skipped = 0;
+			}
+			if (small) {
+				buffer.push_back(ReplayFormat::Nibbles);
+				for (int c = 0; c < ReplayFormat::Components; c += 2) {
+					buffer.push_back(static_cast<uint8_t>((residuals[c] & 0xf) | ((residuals[c + 1] & 0xf) << 4)));
+				}
+				continue;
+			}
+			buffer.push_back(mask);
+			for (int c = 0; c < ReplayFormat::Components; c++) {
+				if (mask & (1 << c)) ReplayFormat::PutSigned(buffer, residuals[c]);
+			}
+		}
+	}
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+
+	MappedFile() : data(nullptr), size(0) {}
+
+	~MappedFile() {
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path) {
+		Close();
+#ifdef _WIN32
+		fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+			Close();
+			return false;
+		}
+		mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) {
+			Close();
+			return false;
+		}
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		size = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int descriptor = open(path.c_str(), O_RDONLY);
+		if (descriptor < 0) return false;
+		struct stat status;
+		if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+			close(descriptor);
+			return false;
+		}
+		void* mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		close(descriptor);
+		if (mapped == MAP_FAILED) return false;
+		data = static_cast<const uint8_t*>(mapped);
+		size = static_cast<size_t>(status.st_size);
+#endif
+		if (!data) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+		mapping = nullptr;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (data) munmap(const_cast<uint8_t*>(data), size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	const uint8_t* Data() const {
+		return data;
+	}
+	size_t Size() const {
+		return size;
+	}
+
+private:
+	const uint8_t* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+// Plays a replay file back without simulating. Seek looks the frame up in the index and decodes from
+// its keyframe, so it costs at most KeyframeInterval frame decodes wherever the frame is; Next decodes
+// one frame.
+class ReplayPlayer {
+public:
+
+	ReplayPlayer() : positionQuantum(0.0f), velocityQuantum(0.0f), rotationQuantum(0.0f), currentFrame(-1) {}
+
+	bool Open(const std::string& path) {
+		Close();
+		if (!file.Open(path) || file.Size() < ReplayFormat::HeaderSize || std::memcmp(file.Data(), ReplayFormat::Magic, 8) != 0) {
+			file.Close();
+			return false;
+		}
+		const uint8_t* header = file.Data() + 8;
+		if (ReplayFormat::Get<uint32_t>(header) != ReplayFormat::Version) {
+			file.Close();
+			return false;
+		}
+		positionQuantum = ReplayFormat::Get<float>(header + 4);
+		velocityQuantum = ReplayFormat::Get<float>(header + 8);
+		rotationQuantum = ReplayFormat::Get<float>(header + 12);
+
+		if (!ReadIndex()) {
+			ScanFrames();
+		}
+		return true;
+	}
+
+	void Close() {
+		file.Close();
+		offsets.clear();
+		keyframes.clear();
+		currentFrame = -1;
+	}
+
+	bool IsOpen() const {
+		return file.Data() != nullptr;
+	}
+
+	size_t GetFrameCount() const {
+		return offsets.size();
+	}
+	// Frame decoded last, or -1
+	long long GetCurrentFrame() const {
+		return currentFrame;
+	}
+
+	bool Seek(size_t frame) {
+		if (frame >= offsets.size()) return false;
+		if (currentFrame >= 0 && static_cast<size_t>(currentFrame) == frame) return true;
+
+		// Continue from the current frame when it lies between the keyframe and the target
+		size_t start = keyframes[frame];
+		if (currentFrame >= static_cast<long long>(start) && static_cast<size_t>(currentFrame) < frame) {
+			start = static_cast<size_t>(currentFrame) + 1;
+		}
+		for (size_t f = start; f <= frame; f++) {
+			if (!DecodeFrame(f)) {
+				currentFrame = -1;
+				return false;
+			}
+		}
+		currentFrame = static_cast<long long>(frame);
+		Dequantize();
+		return true;
+	}
+
+	bool Next() {
+		return Seek(static_cast<size_t>(currentFrame + 1));
+	}
+
+	const ReplayFrame& GetFrame() const {
+		return output;
+	}
+
+private:
+	MappedFile file;
+	float positionQuantum, velocityQuantum, rotationQuantum;
+	std::vector<uint64_t> offsets;
+	std::vector<uint64_t> keyframes; // per frame, the keyframe it is decoded from
+	long long currentFrame;
+	ReplayFormat::QuantizedState current, previous, beforePrevious;
+	std::vector<int64_t> residuals;
+	ReplayFrame output;
+
+	bool ReadIndex() {
+		size_t size = file.Size();
+		if (size < ReplayFormat::HeaderSize + ReplayFormat::TrailerSize) return false;
+		const uint8_t* trailer = file.Data() + size - ReplayFormat::TrailerSize;
+		if (std::memcmp(trailer, ReplayFormat::IndexMagic, 8) != 0) return false;
+
+		uint64_t indexOffset = ReplayFormat::Get<uint64_t>(trailer + 8);
+		uint64_t frameCount = ReplayFormat::Get<uint64_t>(trailer + 16);
+		if (indexOffset + frameCount * ReplayFormat::IndexEntrySize + ReplayFormat::TrailerSize != size) return false;
+
+		offsets.resize(frameCount);
+		keyframes.resize(frameCount);
+		const uint8_t* entry = file.Data() + indexOffset;
+		for (uint64_t f = 0; f < frameCount; f++, entry += ReplayFormat::IndexEntrySize) {
+			offsets[f] = ReplayFormat::Get<uint64_t>(entry);
+			keyframes[f] = ReplayFormat::Get<uint64_t>(entry + 8);
+			if (keyframes[f] > f) return false;
+		}
+		return true;
+	}
+
+	// For a file whose recorder did not close it: walks the frame headers up to the first incomplete frame
+	void ScanFrames() {
+		offsets.clear();
+		keyframes.clear();
+		uint64_t keyframe = 0;
+		size_t offset = ReplayFormat::HeaderSize;
+		while (offset + ReplayFormat::FrameHeaderSize <= file.Size()) {
+			const uint8_t* header = file.Data() + offset;
+			uint32_t payloadSize = ReplayFormat::Get<uint32_t>(header);
+			size_t end = offset + ReplayFormat::FrameHeaderSize + payloadSize;
+			if (end > file.Size()) break;
+
+			if (header[4] == ReplayFormat::Keyframe) keyframe = offsets.size();
+			else if (offsets.empty()) break;
+			offsets.push_back(offset);
+			keyframes.push_back(keyframe);
+			offset = end;
+		}
+	}
+
+	bool DecodeFrame(size_t frame) {
+		const uint8_t* header = file.Data() + offsets[frame];
+		uint32_t payloadSize = ReplayFormat::Get<uint32_t>(header);
+		uint8_t type = header[4];
+		uint64_t step = ReplayFormat::Get<uint64_t>(header + 5);
+		uint32_t count = ReplayFormat::Get<uint32_t>(header + 13);
+		const uint8_t* cursor = header + ReplayFormat::FrameHeaderSize;
+		const uint8_t* end = cursor + payloadSize;
+		if (end > file.Data() + file.Size()) return false;
+
+		if (type == ReplayFormat::Keyframe) {
+			current.Slots.resize(count);
+			current.Values.resize(static_cast<size_t>(count) * ReplayFormat::Components);
+			for (uint32_t i = 0; i < count; i++) {
+				uint64_t slot;
+				if (!ReplayFormat::GetVarint(cursor, end, slot)) return false;
+				current.Slots[i] = static_cast<int>(slot);
+			}
+			for (auto& value : current.Values) {
+				if (!ReplayFormat::GetSigned(cursor, end, value)) return false;
+			}
+			current.StepIndex = step;
+			previous = current;
+			beforePrevious = current;
+			return true;
+		}
+
+		if (count != previous.BodyCount()) return false;
+		residuals.assign(static_cast<size_t>(count) * ReplayFormat::Components, 0);
+		uint64_t body = 0;
+		while (cursor < end) {
+			uint8_t lead = *cursor++;
+			if (lead == ReplayFormat::SkipRun) {
+				uint64_t skipped;
+				if (!ReplayFormat::GetVarint(cursor, end, skipped)) return false;
+				body += skipped;
+				continue;
+			}
+			if (body >= count) return false;
+
+			if (lead == ReplayFormat::Nibbles) {
+				if (end - cursor < ReplayFormat::Components / 2) return false;
+				for (int c = 0; c < ReplayFormat::Components; c += 2) {
+					uint8_t packed = *cursor++;
+					residuals[c * count + body] = ReplayFormat::FromNibble(packed);
+					residuals[(c + 1) * count + body] = ReplayFormat::FromNibble(packed >> 4);
+				}
+			}
+			else {
+				for (int c = 0; c < ReplayFormat::Components; c++) {
+					if (!(lead & (1 << c))) continue;
+					if (!ReplayFormat::GetSigned(cursor, end, residuals[c * count + body])) return false;
+				}
+			}
+			body++;
+		}
+
+		// Same layout as the frame before, so the component offsets of previous apply to current as well
+		current.Values.resize(residuals.size());
+		for (int c = 0; c < ReplayFormat::Components; c++) {
+			const int64_t* last = previous.Component(c);
+			const int64_t* beforeLast = beforePrevious.Component(c);
+			const int64_t* residual = residuals.data() + c * count;
+			int64_t* value = current.Values.data() + c * count;
+			for (uint32_t i = 0; i < count; i++) {
+				value[i] = ReplayFormat::Predict(c, last[i], beforeLast[i]) + residual[i];
+			}
+		}
+		beforePrevious.Values.swap(previous.Values);
+		previous.Values.swap(current.Values);
+		previous.StepIndex = step;
+		return true;
+	}
+
+	void Dequantize() {
+		size_t count = previous.BodyCount();
+		output.StepIndex = previous.StepIndex;
+		output.Slots.assign(previous.Slots.begin(), previous.Slots.end());
+		output.Positions.resize(count);
+		output.LinearVelocities.resize(count);
+		output.Rotations.resize(count);
+		output.RotationalVelocities.resize(count);
+
+		const int64_t* x = previous.Component(0);
+		const int64_t* y = previous.Component(1);
+		const int64_t* vx = previous.Component(2);
+		const int64_t* vy = previous.Component(3);
+		const int64_t* rotation = previous.Component(4);
+		const int64_t* spin = previous.Component(5);
+		for (size_t i = 0; i < count; i++) {
+			output.Positions[i] = FlatVector(x[i] * positionQuantum, y[i] * positionQuantum);
+			output.LinearVelocities[i] = FlatVector(vx[i] * velocityQuantum, vy[i] * velocityQuantum);
+			output.Rotations[i] = rotation[i] * rotationQuantum;
+			output.RotationalVelocities[i] = spin[i] * velocityQuantum;
+		}
+	}
+};
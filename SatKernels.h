@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+
+#include <Vector.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PHYSICS_SAT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(PHYSICS_SAT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PHYSICS_SAT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PHYSICS_SAT_TARGET(isa)
+#endif
+
+// Building block of the separating axis tests: vertex projections onto many axes at once. The SSE
+// and AVX paths handle 4 or 8 axes per instruction and are picked at runtime from the CPU features;
+// the scalar path is the fallback and the reference for both.
+class SatKernels {
+public:
+	enum Level {
+		Scalar = 0,
+		SSE = 1,
+		AVX = 2
+	};
+
+	// Axes handled per batch by Intersections
+	static constexpr int MaxAxes = 64;
+
+	static Level DetectLevel() {
+#ifdef PHYSICS_SAT_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		bool hasSse = (info[3] & (1 << 25)) != 0;
+		bool hasAvx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+#else
+		__builtin_cpu_init();
+		bool hasSse = __builtin_cpu_supports("sse") != 0;
+		bool hasAvx = __builtin_cpu_supports("avx") != 0;
+#endif
+		if (hasAvx) return Level::AVX;
+		if (hasSse) return Level::SSE;
+#endif
+		return Level::Scalar;
+	}
+
+	static Level GetLevel() {
+		return ActiveLevel();
+	}
+
+	// Forces a lower level, e.g. Scalar to compare against the reference. Levels the CPU lacks are ignored.
+	static void SetLevel(Level level) {
+		static const Level detected = DetectLevel();
+		ActiveLevel() = level <= detected ? level : detected;
+	}
+
+	// Min and max of vertex . axis over all (world-space) vertices, for every axis
+	static void ProjectVertices(FlatVectorSpan vertices, const float* axesX, const float* axesY, int axisCount,
+		float* mins, float* maxs) {
+		switch (ActiveLevel()) {
+#ifdef PHYSICS_SAT_X86
+		case Level::AVX: ProjectAvx(vertices, axesX, axesY, axisCount, mins, maxs); break;
+		case Level::SSE: ProjectSse(vertices, axesX, axesY, axisCount, mins, maxs); break;
+#endif
+		default: ProjectScalar(vertices, axesX, axesY, 0, axisCount, mins, maxs); break;
+		}
+	}
+
+private:
+	static Level& ActiveLevel() {
+		static Level level = DetectLevel();
+		return level;
+	}
+
+	static void ProjectScalar(FlatVectorSpan vertices, const float* axesX, const float* axesY, int begin, int end,
+		float* mins, float* maxs) {
+		for (int k = begin; k < end; k++) {
+			FlatVector axis(axesX[k], axesY[k]);
+			float min = std::numeric_limits<float>::max();
+			float max = std::numeric_limits<float>::lowest();
+
+			for (const auto& v : vertices) {
+				float proj = FlatVector::Dot(v, axis);
+				min = std::min(proj, min);
+				max = std::max(proj, max);
+			}
+			mins[k] = min;
+			maxs[k] = max;
+		}
+	}
+
+#ifdef PHYSICS_SAT_X86
+	PHYSICS_SAT_TARGET("sse")
+	static void ProjectSse(FlatVectorSpan vertices, const float* axesX, const float* axesY, int axisCount,
+		float* mins, float* maxs) {
+		int k = 0;
+		for (; k + 4 <= axisCount; k += 4) {
+			__m128 axisX = _mm_loadu_ps(axesX + k);
+			__m128 axisY = _mm_loadu_ps(axesY + k);
+			__m128 min = _mm_set1_ps(std::numeric_limits<float>::max());
+			__m128 max = _mm_set1_ps(std::numeric_limits<float>::lowest());
+
+			for (const auto& v : vertices) {
+				__m128 x = _mm_set1_ps(v.x);
+				__m128 y = _mm_set1_ps(v.y);
+				__m128 proj = _mm_add_ps(_mm_mul_ps(x, axisX), _mm_mul_ps(y, axisY));
+				min = _mm_min_ps(min, proj);
+				max = _mm_max_ps(max, proj);
+			}
+			_mm_storeu_ps(mins + k, min);
+			_mm_storeu_ps(maxs + k, max);
+		}
+		ProjectScalar(vertices, axesX, axesY, k, axisCount, mins, maxs);
+	}
+
+	PHYSICS_SAT_TARGET("avx")
+	static void ProjectAvx(FlatVectorSpan vertices, const float* axesX, const float* axesY, int axisCount,
+		float* mins, float* maxs) {
+		int k = 0;
+		for (; k + 8 <= axisCount; k += 8) {
+			__m256 axisX = _mm256_loadu_ps(axesX + k);
+			__m256 axisY = _mm256_loadu_ps(axesY + k);
+			__m256 min = _mm256_set1_ps(std::numeric_limits<float>::max());
+			__m256 max = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+
+			for (const auto& v : vertices) {
+				__m256 x = _mm256_set1_ps(v.x);
+				__m256 y = _mm256_set1_ps(v.y);
+				__m256 proj = _mm256_add_ps(_mm256_mul_ps(x, axisX), _mm256_mul_ps(y, axisY));
+				min = _mm256_min_ps(min, proj);
+				max = _mm256_max_ps(max, proj);
+			}
+			_mm256_storeu_ps(mins + k, min);
+			_mm256_storeu_ps(maxs + k, max);
+		}
+		// Remaining axes in groups of four, then one by one
+		ProjectSse(vertices, axesX + k, axesY + k, axisCount - k, mins + k, maxs + k);
+	}
+#endif
+};
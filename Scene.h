@@ -0,0 +1,233 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#include <Bodies.h>
+#include <Liquids.h>
+#include <Materials.h>
+#include <Vector.h>
+#include <World.h>
+
+// PCG32 generator for building scenes. The standard distributions are implemented differently by
+// every standard library, so scenes draw from this one and a seed gives the same bodies everywhere.
+class SceneRandom {
+public:
+
+	explicit SceneRandom(uint64_t seed = 1) : state(0), increment(1442695040888963407ull) {
+		NextUInt();
+		state += seed;
+		NextUInt();
+	}
+
+	uint32_t NextUInt() {
+		uint64_t previous = state;
+		state = previous * 6364136223846793005ull + increment;
+		uint32_t shifted = static_cast<uint32_t>(((previous >> 18) ^ previous) >> 27);
+		uint32_t rotation = static_cast<uint32_t>(previous >> 59);
+		return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+	}
+
+	// Uniform in [0, 1), from the top 24 bits so every value is exact in a float
+	float NextFloat() {
+		return static_cast<float>(NextUInt() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	float Range(float min, float max) {
+		return min + (max - min) * NextFloat();
+	}
+
+	// Uniform in [min, max]
+	int Range(int min, int max) {
+		return min + static_cast<int>(NextUInt() % static_cast<uint32_t>(max - min + 1));
+	}
+
+private:
+	uint64_t state;
+	uint64_t increment;
+};
+
+// Shape, size and material that a generator stamps out, passed to the body factories as is
+struct SceneShape {
+	Bodies::ShapeType Type;
+	int NumberOfVertices; // 0 for circles and boxes
+	float Radius;         // circles and regular polygons
+	float Width, Height;  // boxes
+	Materials Material;
+	float Restitution;
+
+	SceneShape(Bodies::ShapeType Type, int NumberOfVertices, float Radius, float Width, float Height, const Materials& Material, float Restitution)
+		: Type(Type), NumberOfVertices(NumberOfVertices), Radius(Radius), Width(Width), Height(Height), Material(Material), Restitution(Restitution) {}
+
+	static SceneShape Circle(float radius, const Materials& material = Materials::CreateBirch(), float restitution = 0.5f) {
+		return SceneShape(Bodies::ShapeType::Circle, 0, radius, 2.0f * radius, 2.0f * radius, material, restitution);
+	}
+	static SceneShape Polygon(int numberOfVertices, float radius, const Materials& material = Materials::CreateBirch(), float restitution = 0.4f) {
+		return SceneShape(Bodies::ShapeType::Polygon, numberOfVertices, radius, 2.0f * radius, 2.0f * radius, material, restitution);
+	}
+	static SceneShape Box(float width, float height, const Materials& material = Materials::CreateOak(), float restitution = 0.4f) {
+		return SceneShape(Bodies::ShapeType::Polygon, 0, 0.5f * std::sqrt(width * width + height * height), width, height, material, restitution);
+	}
+
+	SceneShape Scaled(float factor) const {
+		return SceneShape(Type, NumberOfVertices, Radius * factor, Width * factor, Height * factor, Material, Restitution);
+	}
+
+	// Width and height of the space the shape takes, a regular polygon counting as its circumcircle
+	FlatVector GetSize() const {
+		return FlatVector(Width, Height);
+	}
+
+	// Throws like the body factories when the size is out of their range
+	Bodies Create(const FlatVector& position, bool isStatic = false) const {
+		FlatVector Position = position;
+		if (Type == Bodies::ShapeType::Circle) {
+			return Bodies::CreateCircleBody(Position, Radius, Restitution, isStatic, Material);
+		}
+		if (NumberOfVertices > 0) {
+			return Bodies::CreatePolygonBody(NumberOfVertices, Position, Radius, Restitution, isStatic, Material);
+		}
+		return Bodies::CreateBoxBody(Position, Width, Height, Restitution, isStatic, Material);
+	}
+};
+
+// Collects the bodies, liquids and fluid blocks of a scene from parametric generators and hands them
+// to a world, the bodies in one World::AddBodies call. Every random choice comes from the builder's
+// seeded generator, so the same calls with the same seed build the same scene.
+class SceneBuilder {
+public:
+
+	explicit SceneBuilder(uint64_t seed = 1) : random(seed) {}
+
+	SceneRandom& GetRandom() {
+		return random;
+	}
+	const std::vector<Bodies>& GetBodies() const {
+		return bodies;
+	}
+	const std::vector<Liquids>& GetLiquids() const {
+		return liquids;
+	}
+	size_t GetBodyCount() const {
+		return bodies.size();
+	}
+
+	// Room for count more bodies, so large generators do not reallocate the body list
+	void Reserve(size_t count) {
+		bodies.reserve(bodies.size() + count);
+	}
+
+	void AddBody(const Bodies& body) {
+		bodies.push_back(body);
+	}
+	void AddLiquid(const Liquids& liquid) {
+		liquids.push_back(liquid);
+	}
+
+	// Static box between two corners
+	void AddWall(const FlatVector& min, const FlatVector& max, float restitution = 0.5f, const Materials& material = Materials::CreateSteel()) {
+		bodies.push_back(Bodies::CreatePolygonBody(min, max, restitution, true, material));
+	}
+
+	// Floor and two side walls around [min, max], thickness outside of it
+	void AddContainer(const FlatVector& min, const FlatVector& max, float thickness = 1.0f) {
+		AddWall(FlatVector(min.x, min.y - thickness), FlatVector(max.x, min.y), 0.2f);
+		AddWall(FlatVector(min.x - thickness, min.y), FlatVector(min.x, max.y), 0.8f);
+		AddWall(FlatVector(max.x, min.y), FlatVector(max.x + thickness, max.y), 0.8f);
+	}
+
+	// Particle fluid filling [min, max] at rest spacing, added to the world's ParticleFluid
+	void AddFluidBlock(const FlatVector& min, const FlatVector& max, const FlatVector& velocity = FlatVector(0.0f, 0.0f)) {
+		fluidBlocks.push_back(FluidBlock{ min, max, velocity });
+	}
+
+	// Container with water up to waterLevel
+	void AddLiquidTank(const FlatVector& min, const FlatVector& max, float waterLevel, float thickness = 1.0f) {
+		AddContainer(min, max, thickness);
+		std::vector<FlatVector> WaterBoundries = { FlatVector(min.x, waterLevel), FlatVector(max.x, waterLevel), FlatVector(max.x, min.y), FlatVector(min.x, min.y) };
+		liquids.push_back(Liquids::CreateBodyOfWater(WaterBoundries));
+	}
+
+	// columns x rows bodies, the first one centered on origin and the others spacing apart; each body
+	// is moved by up to jitter on both axes
+	void AddGrid(const FlatVector& origin, int columns, int rows, const FlatVector& spacing, const SceneShape& shape, float jitter = 0.0f) {
+		Reserve(static_cast<size_t>(columns) * rows);
+		for (int row = 0; row < rows; row++) {
+			for (int column = 0; column < columns; column++) {
+				FlatVector position = origin + FlatVector(column * spacing.x, row * spacing.y);
+				if (jitter > 0.0f) {
+					position += FlatVector(random.Range(-jitter, jitter), random.Range(-jitter, jitter));
+				}
+				bodies.push_back(shape.Create(position));
+			}
+		}
+	}
+
+	// count bodies at uniform random positions inside [min, max], which may overlap. Each is a random
+	// pick from shapes, scaled by a random factor in [minScale, 1] and given a random velocity of up
+	// to maxSpeed on both axes.
+	void AddRandomFill(const FlatVector& min, const FlatVector& max, int count, const std::vector<SceneShape>& shapes, float minScale = 1.0f, float maxSpeed = 0.0f) {
+		if (shapes.empty()) return;
+
+		Reserve(count);
+		int lastShape = static_cast<int>(shapes.size()) - 1;
+		for (int i = 0; i < count; i++) {
+			FlatVector position = FlatVector(random.Range(min.x, max.x), random.Range(min.y, max.y));
+			const SceneShape& shape = shapes[random.Range(0, lastShape)];
+			Bodies body = minScale < 1.0f ? shape.Scaled(random.Range(minScale, 1.0f)).Create(position) : shape.Create(position);
+			if (maxSpeed > 0.0f) {
+				body.SetlinearVelocity(FlatVector(random.Range(-maxSpeed, maxSpeed), random.Range(-maxSpeed, maxSpeed)));
+			}
+			bodies.push_back(body);
+		}
+	}
+
+	// Column of count bodies standing on each other, the lowest one resting on base
+	void AddStack(const FlatVector& base, int count, const SceneShape& shape, float gap = 0.0f) {
+		Reserve(count);
+		FlatVector size = shape.GetSize();
+		for (int i = 0; i < count; i++) {
+			bodies.push_back(shape.Create(base + FlatVector(0.0f, 0.5f * size.y + i * (size.y + gap))));
+		}
+	}
+
+	// Rows of baseCount bodies down to one, centered on base, each row resting on the one below
+	void AddPyramid(const FlatVector& base, int baseCount, const SceneShape& shape, float gap = 0.0f) {
+		Reserve(static_cast<size_t>(baseCount) * (baseCount + 1) / 2);
+		FlatVector size = shape.GetSize();
+		for (int row = 0; row < baseCount; row++) {
+			int rowCount = baseCount - row;
+			float left = base.x - 0.5f * (rowCount - 1) * (size.x + gap);
+			float y = base.y + 0.5f * size.y + row * (size.y + gap);
+			for (int i = 0; i < rowCount; i++) {
+				bodies.push_back(shape.Create(FlatVector(left + i * (size.x + gap), y)));
+			}
+		}
+	}
+
+	// Bulk-inserts the bodies, adds the liquids and fluid blocks and empties the builder for the next scene
+	void AddTo(World& world, std::vector<BodyHandle>* handles = nullptr) {
+		world.AddBodies(bodies, handles);
+		for (const auto& liquid : liquids) {
+			world.AddLiquid(liquid);
+		}
+		for (const auto& block : fluidBlocks) {
+			world.GetParticleFluid().AddBlock(block.Min, block.Max, block.Velocity);
+		}
+		bodies.clear();
+		liquids.clear();
+		fluidBlocks.clear();
+	}
+
+private:
+	struct FluidBlock {
+		FlatVector Min, Max;
+		FlatVector Velocity;
+	};
+
+	SceneRandom random;
+	std::vector<Bodies> bodies;
+	std::vector<Liquids> liquids;
+	std::vector<FluidBlock> fluidBlocks;
+};
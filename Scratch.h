@@ -0,0 +1,14 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// Per-step buffers are std::vectors that are cleared, never freed, so they keep their capacity between
+// steps. ReserveScratch grows one ahead of need with headroom: once the counts of pairs and contacts have
+// settled, their small changes from step to step no longer reallocate.
+template<class T>
+inline void ReserveScratch(std::vector<T>& buffer, size_t count) {
+	if (buffer.capacity() < count) {
+		buffer.reserve(count + count / 2);
+	}
+}
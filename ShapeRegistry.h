@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cmath>
+
+#include <Bodies.h>
+#include <Vector.h>
+
+// Geometry shared by every body of the same form. Circles and regular polygons are stored at radius
+// one and scaled per body; uniform scaling keeps the edge normals, and the moment of inertia grows
+// with mass * scale^2.
+struct BodyShape {
+	Bodies::ShapeType Type;
+	float Area;    // at scale 1
+	float Inertia; // per unit mass at scale 1, about the centroid
+	std::vector<FlatVector> Vertices;
+	std::vector<FlatVector> Normals;
+
+	BodyShape(Bodies::ShapeType Type, const std::vector<FlatVector>& Vertices)
+		: Type(Type), Area(ComputeArea(Type, Vertices)), Inertia(ComputeInertia(Type, Vertices)), Vertices(Vertices), Normals(Bodies::CreateEdgeNormals(Vertices)) {}
+
+private:
+	static float ComputeArea(Bodies::ShapeType type, const std::vector<FlatVector>& vertices) {
+		if (type == Bodies::ShapeType::Circle) {
+			return 3.14159265358979323846f;
+		}
+
+		float area = 0.0f;
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const FlatVector& a = vertices[i];
+			const FlatVector& b = vertices[(i + 1) % vertices.size()];
+			area += a.x * b.y - a.y * b.x;
+		}
+		return 0.5f * std::fabs(area);
+	}
+
+	// Vertices are centered on the body position, which is the centroid of every factory shape
+	static float ComputeInertia(Bodies::ShapeType type, const std::vector<FlatVector>& vertices) {
+		if (type == Bodies::ShapeType::Circle) {
+			return 0.5f;
+		}
+
+		float numerator = 0.0f;
+		float denominator = 0.0f;
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const FlatVector& a = vertices[i];
+			const FlatVector& b = vertices[(i + 1) % vertices.size()];
+			float cross = std::fabs(a.x * b.y - a.y * b.x);
+			numerator += cross * (FlatVector::Dot(a, a) + FlatVector::Dot(a, b) + FlatVector::Dot(b, b));
+			denominator += cross;
+		}
+		return denominator > 0.0f ? numerator / (6.0f * denominator) : 0.0f;
+	}
+};
+
+// Interns body shapes so that a thousand equal boxes share one vertex list and one set of edge
+// normals. Ids stay valid for the lifetime of the registry.
+class ShapeRegistry {
+public:
+
+	const BodyShape& Get(int id) const {
+		return shapes[id];
+	}
+
+	size_t Size() const {
+		return shapes.size();
+	}
+
+	int InternCircle() {
+		if (circleId < 0) {
+			circleId = Insert(BodyShape(Bodies::ShapeType::Circle, std::vector<FlatVector>()));
+		}
+		return circleId;
+	}
+
+	// Unit regular polygon, generated once per vertex count
+	int InternRegularPolygon(int numberOfVertices) {
+		if (numberOfVertices >= static_cast<int>(regularPolygonIds.size())) {
+			regularPolygonIds.resize(numberOfVertices + 1, -1);
+		}
+		int& id = regularPolygonIds[numberOfVertices];
+		if (id < 0) {
+			id = Insert(BodyShape(Bodies::ShapeType::Polygon, Bodies::CreatePolygonVertices(numberOfVertices, 1.0f)));
+		}
+		return id;
+	}
+
+	// Polygon with exactly these local vertices, used at scale 1 so that the outline is not rounded
+	int InternPolygon(const std::vector<FlatVector>& vertices) {
+		size_t hash = Hash(vertices);
+		auto range = polygonIds.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (SameVertices(shapes[it->second].Vertices, vertices)) return it->second;
+		}
+
+		int id = Insert(BodyShape(Bodies::ShapeType::Polygon, vertices));
+		polygonIds.emplace(hash, id);
+		return id;
+	}
+
+private:
+	std::vector<BodyShape> shapes;
+	int circleId = -1;
+	std::vector<int> regularPolygonIds;
+	std::unordered_multimap<size_t, int> polygonIds;
+
+	int Insert(const BodyShape& shape) {
+		shapes.push_back(shape);
+		return static_cast<int>(shapes.size()) - 1;
+	}
+
+	static size_t Hash(const std::vector<FlatVector>& vertices) {
+		size_t hash = vertices.size();
+		for (const auto& vertex : vertices) {
+			hash = hash * 31 + std::hash<float>()(vertex.x);
+			hash = hash * 31 + std::hash<float>()(vertex.y);
+		}
+		return hash;
+	}
+
+	static bool SameVertices(const std::vector<FlatVector>& a, const std::vector<FlatVector>& b) {
+		if (a.size() != b.size()) return false;
+		for (size_t i = 0; i < a.size(); i++) {
+			if (a[i].x != b[i].x || a[i].y != b[i].y) return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include <Vector.h>
+#include <Bodies.h>
+
+// Render-side copy of everything drawn: the body state with the shapes and materials the bodies refer
+// to, the liquid outlines and the fluid particles, published by the physics thread after every update.
+// The renderer reads nothing else, since the world's own arrays change under it while it draws.
+struct WorldSnapshot {
+	std::vector<FlatVector> Positions;
+	std::vector<FlatVector> PreviousPositions;
+	std::vector<float> Rotations;
+	std::vector<int> ShapeIds;
+	std::vector<float> Scales;
+	std::vector<float> Radii;
+	std::vector<int> MaterialIds;
+	// Indexed by shape and material id. The registries only grow, so a buffer copies only the entries it lacks
+	std::vector<Bodies::ShapeType> ShapeTypes;
+	std::vector<std::vector<FlatVector>> ShapeVertices;
+	std::vector<std::array<float, 3>> MaterialColors;
+	std::vector<std::vector<FlatVector>> LiquidOutlines;
+	std::vector<FlatVector> FluidPositions;
+	float InterpolationAlpha = 1.0f;
+	uint64_t StepIndex = 0;
+
+	size_t BodyCount() const {
+		return Positions.size();
+	}
+
+	FlatVector GetInterpolatedPosition(int index) const {
+		return PreviousPositions[index] + (Positions[index] - PreviousPositions[index]) * InterpolationAlpha;
+	}
+};
+
+// Single-producer single-consumer triple buffer. The writer fills its private back buffer and swaps it
+// with the shared middle one, the reader swaps the middle one out only when a newer frame is there.
+// Neither side ever waits for the other and the reader always sees a complete frame.
+template <typename T>
+class TripleBuffer {
+public:
+
+	TripleBuffer() : writeIndex(0), middle(1), readIndex(2) {}
+
+	T& GetWriteBuffer() {
+		return buffers[writeIndex];
+	}
+
+	void Publish() {
+		writeIndex = middle.exchange(writeIndex | FreshBit, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	const T& Acquire() {
+		if (middle.load(std::memory_order_relaxed) & FreshBit) {
+			readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & IndexMask;
+		}
+		return buffers[readIndex];
+	}
+
+private:
+	static const int FreshBit = 4;
+	static const int IndexMask = 3;
+
+	T buffers[3];
+	int writeIndex;
+	std::atomic<int> middle;
+	int readIndex;
+};
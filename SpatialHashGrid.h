@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+
+#include <AABB.h>
+#include <CellHashTable.h>
+
+// Uniform grid broad-phase. Every body is binned into each cell its bounding box covers,
+// cells are hashed into a flat table and candidate pairs are taken from bodies sharing a cell.
+// Pairs of two bodies flagged inactive (static or sleeping) are skipped. A body covering more than
+// CellHashTable::MaxCells cells is tested against every other body instead, and a body whose box is
+// not finite gets no pairs.
+class SpatialHashGrid {
+public:
+
+	SpatialHashGrid(float CellSize = 0.0f) : CellSize(CellSize) {}
+
+	// 0 picks the cell size from the average active body extent every step
+	void SetCellSize(float size) {
+		CellSize = size;
+	}
+	float GetCellSize() const {
+		return activeCellSize;
+	}
+
+	// Room for bodyCount bodies covering up to CellsPerBody cells each
+	void Reserve(size_t bodyCount) {
+		cells.Reserve(bodyCount * CellsPerBody);
+		ReserveScratch(placements, bodyCount);
+	}
+
+	void FindPairs(const std::vector<AABB>& boxes, const std::vector<unsigned char>& inactive, std::vector<BodyPair>& pairs) {
+		pairs.clear();
+		if (boxes.size() < 2) return;
+
+		activeCellSize = CellSize > 0.0f ? CellSize : ComputeCellSize(boxes, inactive);
+		float invCellSize = 1.0f / activeCellSize;
+
+		cells.Clear();
+		oversizeBodies.clear();
+		placements.assign(boxes.size(), InCells);
+		for (int i = 0; i < static_cast<int>(boxes.size()); i++) {
+			if (!CellHashTable::IsFinite(boxes[i])) {
+				placements[i] = Rejected;
+			}
+			else if (CellHashTable::CellCount(boxes[i], invCellSize) > CellHashTable::MaxCells) {
+				placements[i] = Oversize;
+				oversizeBodies.push_back(i);
+			}
+			else {
+				cells.Insert(boxes[i], invCellSize, i);
+			}
+		}
+		cells.Build();
+
+		for (int oversize : oversizeBodies) {
+			for (int other = 0; other < static_cast<int>(boxes.size()); other++) {
+				// Two oversize bodies are paired from the lower index only
+				if (placements[other] == Rejected || (placements[other] == Oversize && other <= oversize)) {
+					continue;
+				}
+				if ((inactive[oversize] && inactive[other]) || !AABB::Overlap(boxes[oversize], boxes[other])) {
+					continue;
+				}
+				pairs.push_back(BodyPair(std::min(oversize, other), std::max(oversize, other)));
+			}
+		}
+
+		for (size_t b = 0; b < cells.GetBucketCount(); b++) {
+			const CellHashTable::Entry* bucketEnd = cells.BucketEnd(b);
+			for (const CellHashTable::Entry* entryA = cells.BucketBegin(b); entryA != bucketEnd; entryA++) {
+				for (const CellHashTable::Entry* entryB = entryA + 1; entryB != bucketEnd; entryB++) {
+					if (entryA->X != entryB->X || entryA->Y != entryB->Y) {
+						continue; // different cells sharing a bucket
+					}
+					if (inactive[entryA->Id] && inactive[entryB->Id]) {
+						continue;
+					}
+
+					const AABB& boxA = boxes[entryA->Id];
+					const AABB& boxB = boxes[entryB->Id];
+					if (!AABB::Overlap(boxA, boxB)) {
+						continue;
+					}
+
+					// Bodies sharing several cells are reported only from the cell holding the corner of their overlap
+					if (CellHashTable::CellCoord(std::max(boxA.Min.x, boxB.Min.x), invCellSize) != entryA->X ||
+						CellHashTable::CellCoord(std::max(boxA.Min.y, boxB.Min.y), invCellSize) != entryA->Y) {
+						continue;
+					}
+
+					pairs.push_back(BodyPair(std::min(entryA->Id, entryB->Id), std::max(entryA->Id, entryB->Id)));
+				}
+			}
+		}
+	}
+
+private:
+	enum Placement : unsigned char {
+		InCells,
+		Oversize,
+		Rejected
+	};
+
+	// Boxes this many times the mean extent are left out of the automatic cell size
+	static constexpr float OutlierRatio = 32.0f;
+	static constexpr int CellsPerBody = 4; // a box no larger than a cell covers at most 4
+
+	float CellSize;
+	float activeCellSize = 1.0f;
+	CellHashTable cells;
+	std::vector<int> oversizeBodies;
+	std::vector<unsigned char> placements;
+
+	float ComputeCellSize(const std::vector<AABB>& boxes, const std::vector<unsigned char>& inactive) const {
+		float extentSum = 0.0f;
+		float maxExtent = 0.0f;
+		int count = 0;
+
+		for (int i = 0; i < static_cast<int>(boxes.size()); i++) {
+			if (inactive[i] || !CellHashTable::IsFinite(boxes[i])) continue;
+			float extent = std::max(boxes[i].Max.x - boxes[i].Min.x, boxes[i].Max.y - boxes[i].Min.y);
+			extentSum += extent;
+			maxExtent = std::max(maxExtent, extent);
+			count++;
+		}
+
+		if (count == 0 || extentSum <= 0.0f) return activeCellSize; // keep the last size while everything rests
+
+		// A few huge boxes would make every cell huge; they go to the oversize list anyway, so average without them
+		float outlierExtent = OutlierRatio * extentSum / count;
+		if (maxExtent > outlierExtent) {
+			extentSum = 0.0f;
+			count = 0;
+			for (int i = 0; i < static_cast<int>(boxes.size()); i++) {
+				if (inactive[i] || !CellHashTable::IsFinite(boxes[i])) continue;
+				float extent = std::max(boxes[i].Max.x - boxes[i].Min.x, boxes[i].Max.y - boxes[i].Min.y);
+				if (extent > outlierExtent) continue;
+				extentSum += extent;
+				count++;
+			}
+			if (count == 0 || extentSum <= 0.0f) return activeCellSize;
+		}
+		return 2.0f * extentSum / count;
+	}
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+#include <AABB.h>
+
+// Sweep-and-prune broad-phase. Box endpoints on one axis stay sorted between steps and are
+// repaired with an insertion sort, which is close to linear while bodies move little per step.
+class SweepAndPrune {
+public:
+
+	enum SweepAxis {
+		X = 0,
+		Y = 1
+	};
+
+	SweepAndPrune(SweepAxis Axis = SweepAxis::X) : Axis(Axis), swapCount(0), remapped(false) {}
+
+	void SetAxis(SweepAxis axis) {
+		if (axis != Axis) {
+			Axis = axis;
+			endpoints.clear(); // rebuilt and fully sorted on the next call
+			remapped = false;
+		}
+	}
+	// Number of endpoint swaps the insertion sort needed during the last FindPairs call
+	size_t GetSwapCount() const {
+		return swapCount;
+	}
+
+	// Follows BodyStore::Remove: the body at index goes away and the last body takes its index. Only
+	// the index mapping is updated here, the endpoints are renamed once on the next call.
+	void RemoveBody(int index, int last) {
+		if (endpoints.empty()) return;
+		if (!remapped) {
+			int trackedCount = static_cast<int>(endpoints.size() / 2);
+			currentIndex.resize(trackedCount);
+			std::iota(currentIndex.begin(), currentIndex.end(), 0);
+			trackedIndex.assign(currentIndex.begin(), currentIndex.end());
+			remapped = true;
+		}
+
+		int trackedBodies = static_cast<int>(trackedIndex.size());
+		int removed = index < trackedBodies ? trackedIndex[index] : -1;
+		int moved = last < trackedBodies ? trackedIndex[last] : -1;
+		if (removed >= 0) {
+			currentIndex[removed] = -1;
+		}
+		if (index != last) {
+			if (moved >= 0) currentIndex[moved] = index;
+			if (index < trackedBodies) trackedIndex[index] = moved;
+		}
+		if (last < trackedBodies) {
+			trackedIndex.resize(last);
+		}
+	}
+
+	void FindPairs(const std::vector<AABB>& boxes, const std::vector<unsigned char>& inactive, std::vector<BodyPair>& pairs) {
+		pairs.clear();
+		int bodyCount = static_cast<int>(boxes.size());
+		swapCount = 0;
+
+		bool renamed = remapped;
+		if (remapped) {
+			ApplyRemovals(bodyCount);
+		}
+		int trackedCount = static_cast<int>(endpoints.size() / 2);
+
+		if (trackedCount > bodyCount) {
+			endpoints.erase(std::remove_if(endpoints.begin(), endpoints.end(),
+				[bodyCount](const Endpoint& endpoint) { return endpoint.Body >= bodyCount; }), endpoints.end());
+		}
+
+		for (auto& endpoint : endpoints) {
+			endpoint.Value = EndpointValue(boxes[endpoint.Body], endpoint.IsMax);
+		}
+
+		if (trackedCount < bodyCount || renamed) {
+			for (int i = trackedCount; i < bodyCount; i++) {
+				endpoints.push_back(Endpoint(EndpointValue(boxes[i], false), i, false));
+				endpoints.push_back(Endpoint(EndpointValue(boxes[i], true), i, true));
+			}
+			std::sort(endpoints.begin(), endpoints.end(), EndpointLess);
+		}
+		else {
+			InsertionSort();
+		}
+
+		activeSlot.assign(bodyCount, -1);
+		active.clear();
+		active.reserve(bodyCount); // every box open at once, so a pile spreading along the axis does not grow it
+
+		for (const auto& endpoint : endpoints) {
+			int body = endpoint.Body;
+
+			if (endpoint.IsMax) {
+				int slot = activeSlot[body];
+				active[slot] = active.back();
+				activeSlot[active[slot]] = slot;
+				active.pop_back();
+				activeSlot[body] = -1;
+				continue;
+			}
+
+			for (int other : active) {
+				if (inactive[body] && inactive[other]) {
+					continue;
+				}
+				if (!AABB::Overlap(boxes[body], boxes[other])) {
+					continue;
+				}
+				pairs.push_back(BodyPair(std::min(body, other), std::max(body, other)));
+			}
+
+			activeSlot[body] = static_cast<int>(active.size());
+			active.push_back(body);
+		}
+	}
+
+private:
+	struct Endpoint {
+		float Value;
+		int Body;
+		bool IsMax;
+
+		Endpoint() : Value(0.0f), Body(0), IsMax(false) {}
+		Endpoint(float Value, int Body, bool IsMax) : Value(Value), Body(Body), IsMax(IsMax) {}
+	};
+
+	SweepAxis Axis;
+	size_t swapCount;
+	std::vector<Endpoint> endpoints;
+	std::vector<int> active;
+	std::vector<int> activeSlot;
+
+	// Pending removals: endpoint body index to current body index (-1 once removed), and current
+	// body index to endpoint body index (-1 for a body without endpoints)
+	bool remapped;
+	std::vector<int> currentIndex;
+	std::vector<int> trackedIndex;
+
+	float EndpointValue(const AABB& box, bool isMax) const {
+		const FlatVector& corner = isMax ? box.Max : box.Min;
+		return Axis == SweepAxis::X ? corner.x : corner.y;
+	}
+
+	// Minimums sort before maximums at equal values so touching boxes still overlap
+	static bool EndpointLess(const Endpoint& a, const Endpoint& b) {
+		if (a.Value != b.Value) return a.Value < b.Value;
+		if (a.IsMax != b.IsMax) return !a.IsMax;
+		return a.Body < b.Body;
+	}
+
+	// Renames the endpoints after RemoveBody calls, drops those of removed bodies and adds endpoints for
+	// bodies that were added and then moved below the tracked count
+	void ApplyRemovals(int bodyCount) {
+		endpoints.erase(std::remove_if(endpoints.begin(), endpoints.end(),
+			[this](const Endpoint& endpoint) { return currentIndex[endpoint.Body] < 0; }), endpoints.end());
+		for (auto& endpoint : endpoints) {
+			endpoint.Body = currentIndex[endpoint.Body];
+		}
+
+		int trackedBodies = std::min(static_cast<int>(trackedIndex.size()), bodyCount);
+		for (int i = 0; i < trackedBodies; i++) {
+			if (trackedIndex[i] >= 0) continue;
+			endpoints.push_back(Endpoint(0.0f, i, false));
+			endpoints.push_back(Endpoint(0.0f, i, true));
+		}
+		// Bodies from trackedBodies on are appended by FindPairs as new ones
+		endpoints.erase(std::remove_if(endpoints.begin(), endpoints.end(),
+			[trackedBodies](const Endpoint& endpoint) { return endpoint.Body >= trackedBodies; }), endpoints.end());
+		remapped = false;
+	}
+
+	void InsertionSort() {
+		for (size_t i = 1; i < endpoints.size(); i++) {
+			Endpoint key = endpoints[i];
+			size_t j = i;
+
+			while (j > 0 && EndpointLess(key, endpoints[j - 1])) {
+				endpoints[j] = endpoints[j - 1];
+				j--;
+			}
+			endpoints[j] = key;
+			swapCount += i - j;
+		}
+	}
+};
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <math.h>
+#include <limits>
+#include <ostream>
+#include <vector>
 
 struct FlatVector {
 
@@ -108,4 +111,31 @@ public:
         os << "X: " << v.x << ", Y: " << v.y;
         return os;
     }
-};
\ No newline at end of file
+};
+
+// Non-owning view of contiguous vectors, e.g. a polygon's vertices or edge normals. Geometry is passed
+// to the intersection tests this way so no call copies a vertex list, whatever container holds it.
+struct FlatVectorSpan {
+	const FlatVector* Data;
+	int Count;
+
+	FlatVectorSpan() : Data(nullptr), Count(0) {}
+	FlatVectorSpan(const FlatVector* Data, int Count) : Data(Data), Count(Count) {}
+	FlatVectorSpan(const std::vector<FlatVector>& vectors) : Data(vectors.data()), Count(static_cast<int>(vectors.size())) {}
+
+	int size() const {
+		return Count;
+	}
+	bool empty() const {
+		return Count == 0;
+	}
+	const FlatVector& operator[](int index) const {
+		return Data[index];
+	}
+	const FlatVector* begin() const {
+		return Data;
+	}
+	const FlatVector* end() const {
+		return Data + Count;
+	}
+};
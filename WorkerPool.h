@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+// Fixed set of worker threads that run one task at a time. The calling thread takes part as
+// worker 0, so a pool with a single worker runs everything inline.
+class WorkerPool {
+public:
+
+	WorkerPool() : job(nullptr), jobContext(nullptr), generation(0), pending(0), stopping(false) {}
+
+	~WorkerPool() {
+		StopThreads();
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void SetWorkerCount(int count) {
+		if (count < 1) count = 1;
+		if (count == GetWorkerCount()) return;
+
+		StopThreads();
+		stopping = false;
+		for (int i = 1; i < count; i++) {
+			threads.push_back(std::thread(&WorkerPool::WorkerLoop, this, i, generation));
+		}
+	}
+
+	int GetWorkerCount() const {
+		return static_cast<int>(threads.size()) + 1;
+	}
+
+	// Calls task(workerIndex) once on every worker and returns when all of them finished
+	template <typename Task>
+	void Run(Task& task) {
+		if (threads.empty()) {
+			task(0);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = [](void* context, int worker) { (*static_cast<Task*>(context))(worker); };
+			jobContext = &task;
+			pending = static_cast<int>(threads.size());
+			generation++;
+		}
+		startCondition.notify_all();
+
+		task(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [this] { return pending == 0; });
+	}
+
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+	void (*job)(void*, int);
+	void* jobContext;
+	uint64_t generation;
+	int pending;
+	bool stopping;
+
+	void WorkerLoop(int worker, uint64_t seenGeneration) {
+		while (true) {
+			void (*currentJob)(void*, int);
+			void* currentContext;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				startCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+				if (stopping) return;
+
+				seenGeneration = generation;
+				currentJob = job;
+				currentContext = jobContext;
+			}
+
+			currentJob(currentContext, worker);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--pending == 0) {
+				doneCondition.notify_one();
+			}
+		}
+	}
+
+	void StopThreads() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		startCondition.notify_all();
+
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		threads.clear();
+	}
+};
@@ -2,18 +2,59 @@
 
 #include <vector>
 #include <thread>
-#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
 #include <cmath>
+#include <algorithm>
 
+#include<Determinism.h>
 #include<Bodies.h>
+#include<BodyStore.h>
 #include<Liquids.h>
+#include<LiquidIndex.h>
+#include<ParticleFluid.h>
 #include<Intersections.h>
+#include<SpatialHashGrid.h>
+#include<DynamicTree.h>
+#include<SweepAndPrune.h>
+#include<Snapshot.h>
+#include<Contact.h>
+#include<WorkerPool.h>
+#include<CircleKernels.h>
+#include<ContactSolver.h>
+#include<Scratch.h>
+#include<CommandQueue.h>
+#include<Profiler.h>
+#include<Checkpoint.h>
+
+// Buffers one narrow-phase worker fills during a step, kept between steps
+struct NarrowPhaseScratch {
+    std::vector<Contact> Contacts;
+    CirclePairBatch Circles;
+    WorkerProfile Profile;
+
+    void Reserve(int pairCount) {
+        ReserveScratch(Contacts, pairCount);
+        Circles.Reserve(pairCount);
+    }
+};
 
 struct World {
 
 public:
 
-    World() : isIntersectionThreadRunning(true) {
+    enum BroadPhaseType {
+        AllPairs = 0,
+        SpatialHash = 1,
+        DynamicAABBTree = 2,
+        SweepPrune = 3
+    };
+
+    World() : isIntersectionThreadRunning(true), fixedTimestep(false), fixedDeltaTime(1.0f / 60.0f), maxStepsPerUpdate(5), accumulator(0.0f), 
+        interpolationAlpha(1.0f), stepCount(0), stepContactCount(0), broadPhaseType(BroadPhaseType::SpatialHash),
+        sleepingEnabled(false), sleepVelocity(0.15f), timeToSleep(0.5f), deterministic(false),
+        staticBodiesMoved(false) {
         gravity = FlatVector(0.0f, -9.81f);
     }
 
@@ -22,35 +63,174 @@ public:
     }
 
     const size_t BodyListSize() {
-        return bodyList.size();
+        return bodyStore.Size();
     }
     const size_t LiquidListSize() {
         return liquidList.size();
     }
 
-	void AddBody(const Bodies& body) {
-		bodyList.push_back(body);
+	// The handle stays valid until the body is removed, while its index may change with every removal.
+	// Like RemoveBody and AddLiquid, only for the thread that steps the world; other threads use the
+	// Queue functions.
+	BodyHandle AddBody(const Bodies& body) {
+		return bodyStore.Add(body);
+	}
+	// Bulk insertion for loading scenes: every array is reserved once, and the broad-phase takes the new
+	// bodies in with a single build on the next step instead of one insertion each. Handles, when
+	// given, receive one entry per body in order.
+	void AddBodies(const std::vector<Bodies>& bodies, std::vector<BodyHandle>* handles = nullptr) {
+		bodyStore.AddRange(bodies, handles);
+		ReserveStepBuffers();
 	}
+    // Removes the body in O(1) by moving the last body into its index. Returns false for a stale handle.
+    bool RemoveBody(const BodyHandle& handle) {
+        int index = bodyStore.GetIndex(handle);
+        if (index < 0) {
+            return false;
+        }
+        int last = static_cast<int>(bodyStore.Size()) - 1;
+
+        // Bodies resting on the removed one wake up to fall. A sleeping island named after the last
+        // index, which is then the island of that body alone, takes the freed index as its name.
+        if (bodyStore.IsStatic(index)) {
+            WakeBodiesTouching(index);
+        }
+        else {
+            WakeIsland(index);
+        }
+        if (bodyStore.IsSleeping(last) && bodyStore.IslandIds[last] == last) {
+            bodyStore.IslandIds[last] = index;
+        }
+
+        dynamicTree.RemoveBody(index, last);
+        sweepAndPrune.RemoveBody(index, last);
+        if (last < static_cast<int>(aabbList.size())) {
+            aabbList[index] = aabbList[last];
+            inactiveList[index] = inactiveList[last];
+            aabbList.pop_back();
+            inactiveList.pop_back();
+        }
+        else if (index < static_cast<int>(aabbList.size())) {
+            aabbList.resize(index); // boxes from index on are computed again
+            inactiveList.resize(index);
+        }
+
+        bodyStore.Remove(index);
+        return true;
+    }
+    // Requests from any thread, without locks. They are applied in order at the start of the next
+    // Step, and requests for a body that is gone by then are ignored.
+    BodyHandle QueueAddBody(const Bodies& body) {
+        WorldCommand command;
+        command.Type = WorldCommand::AddBody;
+        command.Handle = bodyStore.ReserveHandle();
+        command.Body.emplace(body);
+        BodyHandle handle = command.Handle;
+        commands.Push(std::move(command));
+        return handle; // resolves to an index once the body was added
+    }
+    void QueueRemoveBody(const BodyHandle& handle) {
+        QueueBodyCommand(WorldCommand::RemoveBody, handle, FlatVector(0.0f, 0.0f), 0.0f);
+    }
+    void QueueSetVelocity(const BodyHandle& handle, const FlatVector& linearVelocity, float rotationalVelocity = 0.0f) {
+        QueueBodyCommand(WorldCommand::SetVelocity, handle, linearVelocity, rotationalVelocity);
+    }
+    // The force acts during the next step only
+    void QueueApplyForce(const BodyHandle& handle, const FlatVector& force) {
+        QueueBodyCommand(WorldCommand::ApplyForce, handle, force, 0.0f);
+    }
+    void QueueMoveBody(const BodyHandle& handle, const FlatVector& amount) {
+        QueueBodyCommand(WorldCommand::MoveBody, handle, amount, 0.0f);
+    }
+    void QueueAddLiquid(const Liquids& liquid) {
+        WorldCommand command;
+        command.Type = WorldCommand::AddLiquid;
+        command.Liquid.emplace(liquid);
+        commands.Push(std::move(command));
+    }
+
+    int GetBodyIndex(const BodyHandle& handle) const {
+        return bodyStore.GetIndex(handle);
+    }
+    BodyHandle GetBodyHandle(int index) const {
+        return bodyStore.GetHandle(index);
+    }
     void AddLiquid(const Liquids& liquid) {
         liquidList.push_back(liquid);
     }
+    // Particle fluid stepped with the bodies and coupled to them, empty until particles are added. Like
+    // AddLiquid, only for the thread that steps the world.
+    ParticleFluid& GetParticleFluid() {
+        return particleFluid;
+    }
+    const ParticleFluid& GetParticleFluid() const {
+        return particleFluid;
+    }
 
-    Bodies* GetBody(int index) {
-        if (index >= 0 && index < bodyList.size()) {
-            return &bodyList[index];
+    const BodyStore& GetBodyStore() const {
+        return bodyStore;
+    }
+    // Shapes and materials interned by AddBody, shared by every body that refers to them
+    const ShapeRegistry& GetShapeRegistry() const {
+        return bodyStore.SharedShapes;
+    }
+    const MaterialTable& GetMaterialTable() const {
+        return bodyStore.SharedMaterials;
+    }
+    void MoveBody(int index, const FlatVector& amount) {
+        if (index >= 0 && index < static_cast<int>(bodyStore.Size())) {
+            WakeBody(index);
+            bodyStore.Move(index, amount);
+            if (bodyStore.IsStatic(index)) {
+                staticBodiesMoved = true; // the broad-phase keeps static boxes until told otherwise
+            }
         }
-        return nullptr;
+    }
+    void MoveBody(const BodyHandle& handle, const FlatVector& amount) {
+        MoveBody(bodyStore.GetIndex(handle), amount);
     }
     Liquids* GetLiquid(int index) {
-        if (index >= 0 && index < liquidList.size()) {
+        if (index >= 0 && index < static_cast<int>(liquidList.size())) {
             return &liquidList[index];
         }
         return nullptr;
     }
 
+    void SetBroadPhase(BroadPhaseType type) {
+        broadPhaseType = type;
+    }
+    BroadPhaseType GetBroadPhase() const {
+        return broadPhaseType;
+    }
+    SpatialHashGrid& GetSpatialHashGrid() {
+        return spatialHashGrid;
+    }
+    DynamicTree& GetDynamicTree() {
+        return dynamicTree;
+    }
+    SweepAndPrune& GetSweepAndPrune() {
+        return sweepAndPrune;
+    }
+    // Number of pairs the broad-phase handed to the narrow-phase in the last step
+    size_t GetCandidatePairCount() const {
+        return candidatePairs.size();
+    }
+    // Number of candidate pairs that were actually touching in the last step
+    size_t GetContactCount() const {
+        return stepContactCount;
+    }
+
+    void SetGravity(const FlatVector& newGravity) {
+        gravity = newGravity;
+    }
+    const FlatVector& GetGravity() const {
+        return gravity;
+    }
+
     void IntersectionThread() {
     std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
     float deltaTime = 0.0f;
+    PublishSnapshot();
 
         while (isIntersectionThreadRunning) {
 
@@ -59,185 +239,965 @@ public:
             deltaTime = timeElapsed.count();
             startTime = endTime;
 
-            for (size_t i = 0; i < bodyList.size(); i++) {
-                Bodies& body = bodyList[i];
+            if (!fixedTimestep) {
+                Step(deltaTime);
+                interpolationAlpha = 1.0f;
+                PublishSnapshot();
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                continue;
+            }
 
-                if (!body.IsStatic) {
-                    //std::lock_guard<std::mutex> lock(intersectionMutex);
-                    body.Step(deltaTime, gravity);
-                }
+            accumulator += deltaTime;
+            int steps = 0;
+            while (accumulator >= fixedDeltaTime && steps < maxStepsPerUpdate) {
+                Step(fixedDeltaTime);
+                accumulator -= fixedDeltaTime;
+                steps++;
             }
+            if (accumulator >= fixedDeltaTime) {
+                accumulator = std::fmod(accumulator, fixedDeltaTime); // drop the steps we could not catch up on
+            }
+            interpolationAlpha = accumulator / fixedDeltaTime;
+            PublishSnapshot();
 
-            for (size_t i = 0; i < bodyList.size() - 1; i++) {
-                Bodies& bodyA = bodyList[i];
+            std::this_thread::sleep_for(std::chrono::duration<float>(fixedDeltaTime - accumulator));
+        }
+    }
 
-                for (size_t j = i + 1; j < bodyList.size(); j++) {
-                    Bodies& bodyB = bodyList[j];
+    // Advances the simulation by one step of deltaTime seconds on the calling thread. Use it instead of
+    // IntersectionThread to drive the world from an external scheduler or a headless process.
+    void Step(float deltaTime) {
+        PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::Step);
+        {
+            PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::Commands);
+            ApplyCommands();
+        }
 
-                    if (bodyA.IsStatic && bodyB.IsStatic) {
-                        continue;
-                    }
+        stepCount++;
+        bodyStore.StorePreviousState();
+        {
+            PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::BroadPhase);
+            FindCandidatePairs();
+        }
+        {
+            PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::NarrowPhase);
+            FindContacts();
+        }
+        stepContactCount = contacts.size();
+        PHYSICS_PROFILE(profiler.Count(ProfileCounter::PairsTested, candidatePairs.size()));
+        PHYSICS_PROFILE(profiler.Count(ProfileCounter::Contacts, contacts.size()));
+        WakeTouchedIslands();
 
-                    FlatVector normal;
-                    float depth;
-                    FlatVector collisionPoint0;
-                    FlatVector collisionPoint1;
-                    int contactCount;
-                    if (Collide(bodyA, bodyB, normal, depth)) { 
-                        Intersections::FindContactPoints(bodyA, bodyB, collisionPoint0, collisionPoint1, contactCount);
-                        if (bodyA.IsStatic) {
-                            bodyB.Move(normal * depth);
-                        }
-                        else if (bodyB.IsStatic) {
-                            bodyA.Move(-normal * depth);
-                        }
-                        else {
-                            bodyA.Move(-normal * depth / 2.0f);
-                            bodyB.Move(normal * depth / 2.0f);
-                        }
-
-                        ResolveCollision(bodyA, bodyB, normal);
-                    }
-                }
-            }  
+        // The contacts found at the start of the step hold for all of its substeps
+        {
+            PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::Solver);
+            contactSolver.BeginStep(bodyStore, contacts);
+        }
+        int substeps = contactSolver.GetSubstepCount();
+        float substepTime = deltaTime / substeps;
+        for (int substep = 0; substep < substeps; substep++) {
+            {
+                PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::IntegrateVelocities);
+                bodyStore.IntegrateVelocities(substepTime, gravity);
+            }
+            {
+                PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::Solver);
+                contactSolver.SolveSubstep(bodyStore, substep, substepTime);
+            }
+            {
+                PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::IntegratePositions);
+                bodyStore.IntegratePositions(substepTime);
+            }
+        }
+        {
+            PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::Solver);
+            contactSolver.EndStep();
+        }
+        bodyStore.ClearForces();
 
-            for (size_t i = 0; i < bodyList.size(); i++) {
-                Bodies& body = bodyList[i];
+        if (particleFluid.Size() > 0) {
+            PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::ParticleFluid);
+            bodyStore.UpdateWorldShapes();
+            particleFluid.Step(deltaTime, gravity, bodyStore, workerPool);
+        }
+        {
+            PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::Liquids);
+            ApplyLiquidForces(deltaTime);
+        }
 
-                for (size_t j = 0; j < liquidList.size(); j++) {
-                    Liquids& liquid = liquidList[j];
+        if (sleepingEnabled) {
+            PHYSICS_PROFILE_SCOPE(profiler, ProfilePhase::Sleeping);
+            UpdateSleeping(deltaTime);
+        }
+    }
 
-                    if (body.IsStatic) {
-                        continue;
-                    }
-                    if (CheckIfObjectIsInsideLiquid(body, liquid)) {
-                        ResolveInteractionBodyFluid(body, liquid);
-                    }
-                    else {
-                        ResolveInteractionBodyAir(body);
-                    }
-                    
-                }
+    void StepN(float deltaTime, int count) {
+        for (int i = 0; i < count; i++) {
+            Step(deltaTime);
+        }
+    }
+
+    // Copies the current state into the snapshot buffer read by AcquireSnapshot
+    void PublishSnapshot() {
+        WorldSnapshot& snapshot = snapshots.GetWriteBuffer();
+        snapshot.Positions.assign(bodyStore.Positions.begin(), bodyStore.Positions.end());
+        snapshot.PreviousPositions.assign(bodyStore.PreviousPositions.begin(), bodyStore.PreviousPositions.end());
+        snapshot.Rotations.assign(bodyStore.Rotations.begin(), bodyStore.Rotations.end());
+        snapshot.ShapeIds.assign(bodyStore.ShapeIds.begin(), bodyStore.ShapeIds.end());
+        snapshot.Scales.assign(bodyStore.Scales.begin(), bodyStore.Scales.end());
+        snapshot.Radii.assign(bodyStore.Radii.begin(), bodyStore.Radii.end());
+        snapshot.MaterialIds.resize(bodyStore.Size());
+        for (size_t i = 0; i < bodyStore.Size(); i++) {
+            snapshot.MaterialIds[i] = bodyStore.MaterialData[i].MaterialId;
+        }
+        for (size_t id = snapshot.ShapeVertices.size(); id < bodyStore.SharedShapes.Size(); id++) {
+            const BodyShape& shape = bodyStore.SharedShapes.Get(static_cast<int>(id));
+            snapshot.ShapeTypes.push_back(shape.Type);
+            snapshot.ShapeVertices.push_back(shape.Vertices);
+        }
+        for (size_t id = snapshot.MaterialColors.size(); id < bodyStore.SharedMaterials.Size(); id++) {
+            snapshot.MaterialColors.push_back(bodyStore.SharedMaterials.Get(static_cast<int>(id)).Color);
+        }
+        snapshot.LiquidOutlines.resize(liquidList.size());
+        for (size_t i = 0; i < liquidList.size(); i++) {
+            snapshot.LiquidOutlines[i].assign(liquidList[i].FluidBoundries.begin(), liquidList[i].FluidBoundries.end());
+        }
+        snapshot.FluidPositions.assign(particleFluid.Positions.begin(), particleFluid.Positions.end());
+        snapshot.InterpolationAlpha = interpolationAlpha;
+        snapshot.StepIndex = stepCount;
+        snapshots.Publish();
+    }
+
+    // Bodies whose island stayed below sleepVelocity (m/s, and rad/s for spin) for timeToSleep seconds are put to sleep together.
+    // Sleeping bodies are skipped by integration, pairing and the solver until something touches them.
+    void SetSleeping(bool enabled, float sleepVelocity = 0.15f, float timeToSleep = 0.5f) {
+        sleepingEnabled = enabled;
+        this->sleepVelocity = sleepVelocity;
+        this->timeToSleep = timeToSleep;
+        if (!enabled) {
+            for (int i = 0; i < static_cast<int>(bodyStore.Size()); i++) {
+                WakeBody(i);
+            }
+        }
+    }
+    bool IsSleepingEnabled() const {
+        return sleepingEnabled;
+    }
+    size_t GetSleepingBodyCount() const {
+        size_t count = 0;
+        for (int i = 0; i < static_cast<int>(bodyStore.Size()); i++) {
+            if (bodyStore.IsSleeping(i)) count++;
+        }
+        return count;
+    }
+    void WakeBody(int index) {
+        if (bodyStore.IsSleeping(index)) {
+            bodyStore.Wake(index);
+        }
+        else if (!bodyStore.IsStatic(index)) {
+            bodyStore.SleepTimes[index] = 0.0f;
+        }
+    }
+    // Wakes every body sleeping in the island of the given one, in one pass over the bodies
+    void WakeIsland(int index) {
+        if (!bodyStore.IsSleeping(index)) {
+            WakeBody(index);
+            return;
+        }
+        int island = bodyStore.IslandIds[index];
+        for (int i = 0; i < static_cast<int>(bodyStore.Size()); i++) {
+            if (bodyStore.IsSleeping(i) && bodyStore.IslandIds[i] == island) {
+                bodyStore.Wake(i);
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(5));
         }
     }
 
+    // Velocity iterations of the contact solver per step. Warm starting reuses the impulses of
+    // contacts that persist from the previous step, so resting stacks need few iterations.
+    void SetSolverIterations(int iterations) {
+        contactSolver.SetIterations(iterations);
+    }
+    int GetSolverIterations() const {
+        return contactSolver.GetIterations();
+    }
+    // Substeps the solver splits a step into (4 by default), sharing its contacts and iterations
+    void SetSolverSubsteps(int substeps) {
+        contactSolver.SetSubsteps(substeps);
+    }
+    int GetSolverSubsteps() const {
+        return contactSolver.GetSubsteps();
+    }
+    void SetWarmStarting(bool enabled) {
+        contactSolver.SetWarmStarting(enabled);
+    }
+    bool IsWarmStarting() const {
+        return contactSolver.IsWarmStarting();
+    }
+
+    // Step phase timings over a rolling window and the pair and contact counters of the last step.
+    // Only recorded when PHYSICS_PROFILING is defined; read it from the thread that steps the world.
+    WorldStats GetStats() const {
+        return profiler.GetStats();
+    }
+    // Chrome trace of every timed phase from StartTrace on. Thread 0 is the stepping thread and
+    // thread n + 1 the narrow-phase range of worker n.
+    void StartTrace(size_t maxEvents = 100000) {
+        profiler.StartTrace(maxEvents);
+    }
+    void StopTrace() {
+        profiler.StopTrace();
+    }
+    bool WriteChromeTrace(const std::string& path) const {
+        return profiler.WriteChromeTrace(path);
+    }
+
+    // Number of threads sharing the narrow-phase, including the one calling Step
+    void SetWorkerCount(int count) {
+        workerPool.SetWorkerCount(count);
+    }
+    int GetWorkerCount() const {
+        return workerPool.GetWorkerCount();
+    }
+
     void StopIntersectionThread() {
         isIntersectionThreadRunning = false;
     }
 
+    // Advances the simulation in constant steps of 1/stepRate seconds. At most maxStepsPerUpdate steps
+    // are taken to catch up with wall-clock time, the rest of the backlog is dropped.
+    void SetFixedTimestep(bool enabled, float stepRate = 60.0f, int maxStepsPerUpdate = 5) {
+        fixedTimestep = enabled || deterministic;
+        fixedDeltaTime = 1.0f / stepRate;
+        this->maxStepsPerUpdate = maxStepsPerUpdate;
+        accumulator = 0.0f;
+    }
+    bool IsFixedTimestep() const {
+        return fixedTimestep;
+    }
+    float GetFixedDeltaTime() const {
+        return fixedDeltaTime;
+    }
+    // Bit-reproducible stepping: the same scene with the same commands at the same steps reaches the
+    // same state in every run, with any worker count and any broad-phase. IntersectionThread keeps a
+    // fixed step, and candidate pairs, and with them the contacts the solver resolves, are taken in
+    // ascending body order instead of the broad-phase's own. Float settings are pinned by building
+    // with PHYSICS_DETERMINISTIC (see Determinism.h). Commands queued from several threads are
+    // applied in arrival order, so lockstep inputs belong on the stepping thread.
+    void SetDeterministic(bool enabled, float stepRate = 60.0f) {
+        deterministic = enabled;
+        if (enabled) {
+            SetFixedTimestep(true, stepRate, maxStepsPerUpdate);
+        }
+    }
+    bool IsDeterministic() const {
+        return deterministic;
+    }
+    // Hash of the step count and the positions, velocities and rotations of all bodies. Peers in
+    // lockstep compare it to detect a desync.
+    uint64_t GetStateHash() const {
+        uint64_t hash = HashBytes(HashSeed, &stepCount, sizeof(stepCount));
+        hash = HashBytes(hash, bodyStore.Positions.data(), bodyStore.Positions.size() * sizeof(FlatVector));
+        hash = HashBytes(hash, bodyStore.LinearVelocities.data(), bodyStore.LinearVelocities.size() * sizeof(FlatVector));
+        hash = HashBytes(hash, bodyStore.Rotations.data(), bodyStore.Rotations.size() * sizeof(float));
+        hash = HashBytes(hash, bodyStore.RotationalVelocities.data(), bodyStore.RotationalVelocities.size() * sizeof(float));
+        hash = HashBytes(hash, particleFluid.Positions.data(), particleFluid.Positions.size() * sizeof(FlatVector));
+        hash = HashBytes(hash, particleFluid.Velocities.data(), particleFluid.Velocities.size() * sizeof(FlatVector));
+        return hash;
+    }
+
+    // Latest complete frame published by the intersection thread. Never blocks, and must only be
+    // called from one reader thread.
+    const WorldSnapshot& AcquireSnapshot() {
+        return snapshots.Acquire();
+    }
+    uint64_t GetStepCount() const {
+        return stepCount;
+    }
+
+    // Fraction of a fixed step left in the accumulator, for blending the previous and current positions
+    float GetInterpolationAlpha() const {
+        return interpolationAlpha;
+    }
+
+    // Keeps the last frameCount checkpoints for rollback. Each frame is preallocated for bodies
+    // bodies (at least the current count), so saving does not allocate until the world outgrows it.
+    void SetCheckpointCapacity(int frameCount, size_t bodies = 0) {
+        size_t manifolds = contactSolver.GetManifoldCount();
+        checkpoints.SetCapacity(frameCount, std::max(bodies, bodyStore.Size()), manifolds + manifolds / 2, particleFluid.Size());
+    }
+    int GetCheckpointCapacity() const {
+        return checkpoints.GetCapacity();
+    }
+    // Saves the dynamic state between two steps and returns the id that restores it, or 0 without
+    // checkpoint frames. Queued commands that were not applied yet are not part of it.
+    uint64_t SaveCheckpoint() {
+        if (checkpoints.GetCapacity() == 0) {
+            return 0;
+        }
+        WorldCheckpoint& frame = checkpoints.Next();
+        frame.StepIndex = stepCount;
+        frame.LayoutVersion = bodyStore.GetLayoutVersion();
+        frame.LiquidCount = liquidList.size();
+        CopyPod(frame.Positions, bodyStore.Positions);
+        CopyPod(frame.LinearVelocities, bodyStore.LinearVelocities);
+        CopyPod(frame.Forces, bodyStore.Forces);
+        CopyPod(frame.LiquidDisplacements, bodyStore.LiquidDisplacements);
+        CopyPod(frame.Rotations, bodyStore.Rotations);
+        CopyPod(frame.RotationalVelocities, bodyStore.RotationalVelocities);
+        CopyPod(frame.Flags, bodyStore.Flags);
+        CopyPod(frame.SleepTimes, bodyStore.SleepTimes);
+        CopyPod(frame.IslandIds, bodyStore.IslandIds);
+        CopyPod(frame.Manifolds, contactSolver.GetCachedManifolds());
+        CopyPod(frame.FluidPositions, particleFluid.Positions);
+        CopyPod(frame.FluidVelocities, particleFluid.Velocities);
+        return frame.Id;
+    }
+    // Puts the world back into the state of a checkpoint. Fails when the checkpoint was overwritten,
+    // or when bodies were added or removed since it was taken; liquids and fluid particles added since
+    // then are dropped.
+    bool RestoreCheckpoint(uint64_t id) {
+        if (!CanRestoreCheckpoint(id)) {
+            return false;
+        }
+        const WorldCheckpoint& frame = *checkpoints.Find(id);
+        stepCount = frame.StepIndex;
+        liquidList.erase(liquidList.begin() + frame.LiquidCount, liquidList.end());
+        CopyPod(bodyStore.Positions, frame.Positions);
+        CopyPod(bodyStore.LinearVelocities, frame.LinearVelocities);
+        CopyPod(bodyStore.Forces, frame.Forces);
+        CopyPod(bodyStore.LiquidDisplacements, frame.LiquidDisplacements);
+        CopyPod(bodyStore.Rotations, frame.Rotations);
+        CopyPod(bodyStore.RotationalVelocities, frame.RotationalVelocities);
+        CopyPod(bodyStore.Flags, frame.Flags);
+        CopyPod(bodyStore.SleepTimes, frame.SleepTimes);
+        CopyPod(bodyStore.IslandIds, frame.IslandIds);
+        contactSolver.SetCachedManifolds(frame.Manifolds);
+        CopyPod(particleFluid.Positions, frame.FluidPositions);
+        CopyPod(particleFluid.Velocities, frame.FluidVelocities);
+        particleFluid.StateChanged();
+
+        // Nothing to interpolate from, and every cached shape and box may be out of date
+        CopyPod(bodyStore.PreviousPositions, bodyStore.Positions);
+        CopyPod(bodyStore.PreviousRotations, bodyStore.Rotations);
+        for (auto& flags : bodyStore.Flags) {
+            flags |= BodyStore::BodyFlags::TransformDirty;
+        }
+        aabbList.clear();
+        inactiveList.clear();
+        dynamicTree.RefitAll();
+        return true;
+    }
+    bool CanRestoreCheckpoint(uint64_t id) const {
+        const WorldCheckpoint* frame = checkpoints.Find(id);
+        return frame != nullptr && frame->LayoutVersion == bodyStore.GetLayoutVersion() && frame->LiquidCount <= liquidList.size();
+    }
+    // Newest checkpoint saved after the given step, or 0
+    uint64_t FindCheckpoint(uint64_t step) const {
+        return checkpoints.FindStep(step);
+    }
+
 private:
-    std::mutex intersectionMutex;
     FlatVector gravity;
-    std::vector<Bodies> bodyList;
+    BodyStore bodyStore;
     std::vector<Liquids> liquidList;
-    bool isIntersectionThreadRunning;
+    LiquidIndex liquidIndex;
+    std::vector<int> liquidHits;
+    std::vector<FlatVector> clipBufferA;
+    std::vector<FlatVector> clipBufferB;
+    ParticleFluid particleFluid;
+    std::vector<int> fluidHits;
+    std::vector<FlatVector> fluidReactions; // velocity change of every particle from the bodies in it, this step
+    std::atomic<bool> isIntersectionThreadRunning;
+    bool fixedTimestep;
+    float fixedDeltaTime;
+    int maxStepsPerUpdate;
+    float accumulator;
+    float interpolationAlpha;
+    uint64_t stepCount;
+    size_t stepContactCount;
+    TripleBuffer<WorldSnapshot> snapshots;
+    BroadPhaseType broadPhaseType;
+    SpatialHashGrid spatialHashGrid;
+    DynamicTree dynamicTree;
+    SweepAndPrune sweepAndPrune;
+    std::vector<AABB> aabbList;
+    std::vector<unsigned char> inactiveList;
+    bool sleepingEnabled;
+    float sleepVelocity;
+    float timeToSleep;
+    bool deterministic;
+    bool staticBodiesMoved;
+    std::vector<int> islandParent;
+    std::vector<float> islandSleepTime;
+    std::vector<unsigned char> wakeIslands;
+    std::vector<BodyPair> candidatePairs;
+    WorkerPool workerPool;
+    std::vector<NarrowPhaseScratch> narrowPhaseScratch;
+    std::vector<Contact> contacts;
+    ContactSolver contactSolver;
+    MpscQueue<WorldCommand> commands;
+    Profiler profiler;
+    CheckpointRing checkpoints;
+
+    static const int MinPairsPerWorker = 256;
+    static const int ContactsPerBody = 2; // a settled pile of circles has about 1.5
+    static constexpr float PolygonResistanceCoefficient = 1.05f; // drag coefficient of a flat-faced body
+
+    void QueueBodyCommand(WorldCommand::CommandType type, const BodyHandle& handle, const FlatVector& vector, float scalar) {
+        WorldCommand command;
+        command.Type = type;
+        command.Handle = handle;
+        command.Vector = vector;
+        command.Scalar = scalar;
+        commands.Push(std::move(command));
+    }
+
+    // Drains the command queue in one batch before the step reads any body state
+    void ApplyCommands() {
+        while (commands.Pop([this](WorldCommand& command) { ApplyCommand(command); })) {}
+    }
 
-    bool Collide(Bodies& bodyA, Bodies& bodyB, FlatVector& normal, float& depth) {
+    void ApplyCommand(WorldCommand& command) {
+        if (command.Type == WorldCommand::AddBody) {
+            bodyStore.AddReserved(*command.Body, command.Handle);
+            return;
+        }
+        if (command.Type == WorldCommand::AddLiquid) {
+            liquidList.push_back(*command.Liquid);
+            return;
+        }
+
+        int index = bodyStore.GetIndex(command.Handle);
+        if (index < 0) return;
+
+        switch (command.Type) {
+        case WorldCommand::RemoveBody:
+            RemoveBody(command.Handle);
+            break;
+        case WorldCommand::MoveBody:
+            MoveBody(index, command.Vector);
+            break;
+        case WorldCommand::SetVelocity:
+            if (bodyStore.IsStatic(index)) break;
+            WakeBody(index);
+            bodyStore.LinearVelocities[index] = command.Vector;
+            bodyStore.RotationalVelocities[index] = command.Scalar;
+            break;
+        case WorldCommand::ApplyForce:
+            if (bodyStore.IsStatic(index)) break;
+            WakeBody(index);
+            bodyStore.Forces[index] += command.Vector;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Narrow-phase over the candidate pairs. Every worker takes a contiguous range of pairs and only
+    // reads body state, writing into its own buffer. The buffers are merged in range order, so the
+    // contact list is the same whatever the worker count.
+    void FindContacts() {
+        int pairCount = static_cast<int>(candidatePairs.size());
+        int workers = std::min(workerPool.GetWorkerCount(), std::max(1, pairCount / MinPairsPerWorker));
+        if (static_cast<int>(narrowPhaseScratch.size()) < workers) {
+            narrowPhaseScratch.resize(workers);
+        }
+
+        auto task = [this, pairCount, workers](int worker) {
+            if (worker >= workers) return;
+
+            int begin = static_cast<int>(static_cast<long long>(pairCount) * worker / workers);
+            int end = static_cast<int>(static_cast<long long>(pairCount) * (worker + 1) / workers);
+
+            // A range yields at most one contact and one circle pair per candidate pair
+            NarrowPhaseScratch& scratch = narrowPhaseScratch[worker];
+            scratch.Reserve(end - begin);
+            PHYSICS_PROFILE(scratch.Profile.Reset());
+            PHYSICS_PROFILE(scratch.Profile.Begin = profiler.Now());
+
+            std::vector<Contact>& buffer = scratch.Contacts;
+            buffer.clear();
+
+            // Circle pairs of the range are rejected in bulk first, then every pair is visited in order
+            CirclePairBatch& circles = scratch.Circles;
+            circles.Clear();
+            for (int i = begin; i < end; i++) {
+                if (IsCirclePair(candidatePairs[i])) {
+                    int bodyA = candidatePairs[i].A;
+                    int bodyB = candidatePairs[i].B;
+                    circles.Add(bodyStore.Positions[bodyA], bodyStore.Positions[bodyB], bodyStore.Radii[bodyA] + bodyStore.Radii[bodyB]);
+                }
+            }
+            CircleKernels::FindOverlaps(circles);
+
+            int circleIndex = 0;
+            size_t nextOverlap = 0;
+            for (int i = begin; i < end; i++) {
+                Contact contact;
+                contact.A = candidatePairs[i].A;
+                contact.B = candidatePairs[i].B;
+
+                if (IsCirclePair(candidatePairs[i])) {
+                    if (nextOverlap == circles.Overlaps.size() || circles.Overlaps[nextOverlap] != circleIndex++) {
+                        PHYSICS_PROFILE(scratch.Profile.Count(ProfileCounter::CircleRejections));
+                        continue;
+                    }
+                    nextOverlap++;
+
+                    const FlatVector& positionA = bodyStore.Positions[contact.A];
+                    float radiusA = bodyStore.Radii[contact.A];
+                    if (Intersections::CircleIntersection(positionA, radiusA, bodyStore.Positions[contact.B], bodyStore.Radii[contact.B],
+                        contact.Normal, contact.Depth)) {
+                        contact.Point0 = positionA + contact.Normal * radiusA;
+                        contact.Depth0 = contact.Depth;
+                        contact.PointCount = 1;
+                        buffer.push_back(contact);
+                    }
+                    continue;
+                }
+
+                PHYSICS_PROFILE(int64_t collideBegin = profiler.Now());
+                bool touching = Collide(contact.A, contact.B, contact.Normal, contact.Depth);
+                PHYSICS_PROFILE(int64_t collideEnd = profiler.Now());
+                PHYSICS_PROFILE(scratch.Profile.Nanoseconds[static_cast<int>(ProfilePhase::Collide)] += collideEnd - collideBegin);
+                if (!touching) {
+                    PHYSICS_PROFILE(scratch.Profile.Count(ProfileCounter::SatEarlyOuts));
+                    continue;
+                }
+
+                Intersections::FindContactPoints(bodyStore.Positions[contact.A], bodyStore.GetShape(contact.A), bodyStore.Radii[contact.A], bodyStore.GetWorldVertices(contact.A), bodyStore.GetWorldNormals(contact.A),
+                    bodyStore.Positions[contact.B], bodyStore.GetShape(contact.B), bodyStore.GetWorldVertices(contact.B), bodyStore.GetWorldNormals(contact.B),
+                    contactSolver.GetPreferredReference(bodyStore, contact.A, contact.B), contact);
+                PHYSICS_PROFILE(scratch.Profile.Nanoseconds[static_cast<int>(ProfilePhase::ContactPoints)] += profiler.Now() - collideEnd);
+                buffer.push_back(contact);
+            }
+            PHYSICS_PROFILE(scratch.Profile.End = profiler.Now());
+        };
+        if (workers > 1) {
+            workerPool.Run(task);
+        }
+        else {
+            task(0);
+        }
+
+        size_t contactCount = 0;
+        for (int worker = 0; worker < workers; worker++) {
+            contactCount += narrowPhaseScratch[worker].Contacts.size();
+            PHYSICS_PROFILE(profiler.MergeWorker(narrowPhaseScratch[worker].Profile, worker + 1));
+        }
+        ReserveScratch(contacts, contactCount);
+
+        contacts.clear();
+        for (int worker = 0; worker < workers; worker++) {
+            const std::vector<Contact>& buffer = narrowPhaseScratch[worker].Contacts;
+            contacts.insert(contacts.end(), buffer.begin(), buffer.end());
+        }
+    }
+
+    // Sizes the broad-phase, pair, contact and manifold buffers from the body count when a scene is
+    // loaded, so the steps of a scene that is still settling do not grow them one after another
+    void ReserveStepBuffers() {
+        size_t bodyCount = bodyStore.Size();
+        size_t contactCount = bodyCount * ContactsPerBody;
+        spatialHashGrid.Reserve(bodyCount);
+        dynamicTree.Reserve(bodyCount, contactCount);
+        ReserveScratch(candidatePairs, contactCount);
+        ReserveScratch(contacts, contactCount);
+
+        int workers = workerPool.GetWorkerCount();
+        if (static_cast<int>(narrowPhaseScratch.size()) < workers) {
+            narrowPhaseScratch.resize(workers);
+        }
+        for (auto& scratch : narrowPhaseScratch) {
+            scratch.Reserve(static_cast<int>(contactCount / workers) + MinPairsPerWorker);
+        }
+        contactSolver.Reserve(contactCount, bodyCount);
+
+        // Clipping a polygon to a box adds at most one vertex per side
+        size_t clipCount = 0;
+        for (size_t i = 0; i < bodyCount; i++) {
+            clipCount = std::max(clipCount, bodyStore.GetShape(static_cast<int>(i)).Vertices.size() + 4);
+        }
+        ReserveScratch(clipBufferA, clipCount);
+        ReserveScratch(clipBufferB, clipCount);
+    }
+
+    // A sleeping body touched by an awake dynamic body wakes up together with its whole island
+    void WakeTouchedIslands() {
+        if (!sleepingEnabled) return;
+
+        // Sized every step, not on the first wake, so waking never allocates
+        wakeIslands.resize(bodyStore.Size(), 0);
+
+        bool anyWake = false;
+        for (const Contact& contact : contacts) {
+            int sleeper = -1;
+            if (bodyStore.IsSleeping(contact.A) && !bodyStore.IsInactive(contact.B)) sleeper = contact.A;
+            else if (bodyStore.IsSleeping(contact.B) && !bodyStore.IsInactive(contact.A)) sleeper = contact.B;
+            if (sleeper < 0) continue;
+
+            wakeIslands[bodyStore.IslandIds[sleeper]] = 1;
+            anyWake = true;
+        }
+        if (!anyWake) return;
+
+        for (int i = 0; i < static_cast<int>(bodyStore.Size()); i++) {
+            if (bodyStore.IsSleeping(i) && wakeIslands[bodyStore.IslandIds[i]]) {
+                bodyStore.Wake(i);
+            }
+        }
+        std::fill(wakeIslands.begin(), wakeIslands.end(), 0);
+    }
+
+    // Static bodies take no part in islands, so sleepers are found by their boxes
+    void WakeBodiesTouching(int index) {
+        AABB box = bodyStore.GetAABB(index).Fattened(0.01f);
+        for (int i = 0; i < static_cast<int>(bodyStore.Size()); i++) {
+            if (bodyStore.IsSleeping(i) && AABB::Overlap(bodyStore.GetAABB(i), box)) {
+                WakeIsland(i);
+            }
+        }
+    }
+
+    int FindIsland(int body) {
+        while (islandParent[body] != body) {
+            islandParent[body] = islandParent[islandParent[body]];
+            body = islandParent[body];
+        }
+        return body;
+    }
+
+    // Builds islands from the contact graph of awake dynamic bodies and puts an island to sleep
+    // once every body in it has been slow for timeToSleep
+    void UpdateSleeping(float deltaTime) {
+        int bodyCount = static_cast<int>(bodyStore.Size());
+        islandParent.resize(bodyCount);
+        float sleepVelocitySquared = sleepVelocity * sleepVelocity;
+
+        for (int i = 0; i < bodyCount; i++) {
+            islandParent[i] = i;
+            if (bodyStore.IsInactive(i)) continue;
+
+            if (FlatVector::DistanceSquared(bodyStore.LinearVelocities[i]) > sleepVelocitySquared ||
+                std::fabs(bodyStore.RotationalVelocities[i]) > sleepVelocity) {
+                bodyStore.SleepTimes[i] = 0.0f;
+            }
+            else {
+                bodyStore.SleepTimes[i] += deltaTime;
+            }
+        }
+
+        for (const Contact& contact : contacts) {
+            if (bodyStore.IsInactive(contact.A) || bodyStore.IsInactive(contact.B)) continue;
+
+            int rootA = FindIsland(contact.A);
+            int rootB = FindIsland(contact.B);
+            if (rootA != rootB) {
+                islandParent[std::max(rootA, rootB)] = std::min(rootA, rootB);
+            }
+        }
+
+        islandSleepTime.assign(bodyCount, std::numeric_limits<float>::max());
+        for (int i = 0; i < bodyCount; i++) {
+            if (bodyStore.IsInactive(i)) continue;
+            int root = FindIsland(i);
+            islandSleepTime[root] = std::min(islandSleepTime[root], bodyStore.SleepTimes[i]);
+        }
+
+        for (int i = 0; i < bodyCount; i++) {
+            if (bodyStore.IsInactive(i)) continue;
+            int root = FindIsland(i);
+            if (islandSleepTime[root] < timeToSleep) continue;
+
+            bodyStore.Sleep(i, root); // the lowest body index of the island identifies it while it sleeps
+        }
+    }
+
+    void FindCandidatePairs() {
+        bodyStore.UpdateWorldShapes();
+
+        size_t bodyCount = bodyStore.Size();
+        size_t knownBodies = std::min(aabbList.size(), bodyCount);
+        aabbList.resize(bodyCount);
+        inactiveList.resize(bodyCount);
+        for (size_t i = 0; i < bodyCount; i++) {
+            inactiveList[i] = bodyStore.IsInactive(i);
+            if (i < knownBodies && inactiveList[i] && !staticBodiesMoved) {
+                continue; // static and sleeping bodies keep their box
+            }
+            aabbList[i] = bodyStore.GetAABB(i);
+        }
+        if (staticBodiesMoved) {
+            dynamicTree.RefitAll();
+            staticBodiesMoved = false;
+        }
+
+        if (broadPhaseType == BroadPhaseType::SpatialHash) {
+            spatialHashGrid.FindPairs(aabbList, inactiveList, candidatePairs);
+        }
+        else if (broadPhaseType == BroadPhaseType::DynamicAABBTree) {
+            dynamicTree.FindPairs(aabbList, inactiveList, candidatePairs);
+        }
+        else if (broadPhaseType == BroadPhaseType::SweepPrune) {
+            sweepAndPrune.FindPairs(aabbList, inactiveList, candidatePairs);
+        }
+        else {
+            FindAllPairs(bodyCount);
+            return; // already in ascending order
+        }
+
+        // The grid reports pairs by hash bucket and sweep-and-prune by endpoint order, both of which
+        // depend on where the bodies are and on earlier steps. The tree keeps its pairs sorted.
+        if (deterministic && broadPhaseType != BroadPhaseType::DynamicAABBTree) {
+            std::sort(candidatePairs.begin(), candidatePairs.end(),
+                [](const BodyPair& a, const BodyPair& b) { return a.A != b.A ? a.A < b.A : a.B < b.B; });
+        }
+    }
+
+    void FindAllPairs(size_t bodyCount) {
+        candidatePairs.clear();
+        for (int i = 0; i + 1 < static_cast<int>(bodyCount); i++) {
+            for (int j = i + 1; j < static_cast<int>(bodyCount); j++) {
+                if (inactiveList[i] && inactiveList[j]) {
+                    continue;
+                }
+                candidatePairs.push_back(BodyPair(i, j));
+            }
+        }
+    }
+
+    bool IsCirclePair(const BodyPair& pair) const {
+        return bodyStore.GetShape(pair.A).Type == Bodies::ShapeType::Circle && bodyStore.GetShape(pair.B).Type == Bodies::ShapeType::Circle;
+    }
+
+    bool Collide(int bodyA, int bodyB, FlatVector& normal, float& depth) const {
+        const FlatVector& positionA = bodyStore.Positions[bodyA];
+        const FlatVector& positionB = bodyStore.Positions[bodyB];
+        const BodyShape& shapeA = bodyStore.GetShape(bodyA);
+        const BodyShape& shapeB = bodyStore.GetShape(bodyB);
+        FlatVectorSpan verticesA = bodyStore.GetWorldVertices(bodyA);
+        FlatVectorSpan verticesB = bodyStore.GetWorldVertices(bodyB);
         
-        if (bodyA.Type == Bodies::ShapeType::Polygon) {
-            if (bodyB.Type == Bodies::ShapeType::Polygon) {
-                return Intersections::IntersectPolygons(bodyA.Position, bodyA.Vertices, bodyB.Position, bodyB.Vertices, normal, depth);
+        if (shapeA.Type == Bodies::ShapeType::Polygon) {
+            if (shapeB.Type == Bodies::ShapeType::Polygon) {
+                return Intersections::IntersectPolygons(positionA, verticesA, bodyStore.GetWorldNormals(bodyA), positionB, verticesB, bodyStore.GetWorldNormals(bodyB), normal, depth);
             }
-            else if (bodyB.Type == Bodies::ShapeType::Circle) {
-                bool intersection = Intersections::IntersectCirclePolygon(bodyB.Position, bodyB.Radius, bodyA.Position, bodyA.Vertices, normal, depth);
+            else if (shapeB.Type == Bodies::ShapeType::Circle) {
+                bool intersection = Intersections::IntersectCirclePolygon(positionB, bodyStore.Radii[bodyB], positionA, verticesA, bodyStore.GetWorldNormals(bodyA), normal, depth);
                 normal = -normal;
                 return intersection;
             }
         }
         
-        if (bodyA.Type == Bodies::ShapeType::Circle) {
-            if (bodyB.Type == Bodies::ShapeType::Polygon) {
-                return Intersections::IntersectCirclePolygon(bodyA.Position, bodyA.Radius, bodyB.Position, bodyB.Vertices, normal, depth);
+        if (shapeA.Type == Bodies::ShapeType::Circle) {
+            if (shapeB.Type == Bodies::ShapeType::Polygon) {
+                return Intersections::IntersectCirclePolygon(positionA, bodyStore.Radii[bodyA], positionB, verticesB, bodyStore.GetWorldNormals(bodyB), normal, depth);
                 
             }
-            else if (bodyB.Type == Bodies::ShapeType::Circle) {
-                return Intersections::CircleIntersection(bodyA.Position, bodyA.Radius, bodyB.Position, bodyB.Radius, normal, depth);
+            else if (shapeB.Type == Bodies::ShapeType::Circle) {
+                return Intersections::CircleIntersection(positionA, bodyStore.Radii[bodyA], positionB, bodyStore.Radii[bodyB], normal, depth);
             }
         }
 
         return false;
     }
 
-    bool CheckIfObjectIsInsideLiquid(Bodies& body, Liquids& liquid) {
-        if (body.Type == Bodies::ShapeType::Circle) {
-            return Intersections::IntersectLiquidCircle(body.Position, body.Radius, liquid.FluidBoundries);
+    // Every active body gets buoyancy and drag from each liquid it is in, found through the liquid
+    // index, and from the particle fluid around it, and air drag once when it is in neither
+    void ApplyLiquidForces(float deltaTime) {
+        if (!liquidList.empty()) {
+            if (liquidIndex.GetLiquidCount() != liquidList.size()) {
+                liquidIndex.Build(liquidList); // liquids are only appended, or truncated by RestoreCheckpoint
+            }
+        }
+        bool particles = particleFluid.Size() > 0;
+        AABB fluidBounds = particles ? particleFluid.GetBounds().Fattened(particleFluid.GetSmoothingRadius()) : AABB();
+        if (particles) {
+            fluidReactions.assign(particleFluid.Size(), FlatVector(0.0f, 0.0f));
+            fluidHits.reserve(particleFluid.Size()); // a body sinking deeper reaches more particles each step
+        }
+        if (!liquidList.empty() || particles) {
+            bodyStore.UpdateWorldShapes(); // polygons are clipped at their new positions
         }
-    }
-    
-    void ResolveCollision(Bodies& bodyA, Bodies& bodyB, FlatVector& normal) {
-        FlatVector relativeVelocity = bodyB.GetlinearVelocity() - bodyA.GetlinearVelocity();
 
-        if (FlatVector::Dot(relativeVelocity, normal) > 0.0f) {
-            return;
+        for (int body = 0; body < static_cast<int>(bodyStore.Size()); body++) {
+            if (bodyStore.IsInactive(body)) {
+                continue;
+            }
+
+            bool submerged = false;
+            if (!liquidList.empty() || particles) {
+                AABB bodyBox = bodyStore.GetAABB(body);
+                if (!liquidList.empty()) {
+                    liquidIndex.Query(bodyBox, liquidHits);
+                    for (int liquid : liquidHits) {
+                        submerged |= ResolveInteractionBodyFluid(body, bodyBox, liquid);
+                    }
+                }
+                if (particles && AABB::Overlap(bodyBox, fluidBounds)) {
+                    submerged |= ResolveInteractionBodyParticles(body, bodyBox, deltaTime);
+                }
+            }
+            if (!submerged) {
+                ResolveInteractionBodyAir(body);
+            }
+        }
+        if (particles) {
+            particleFluid.AddVelocities(fluidReactions); // after the loop, so every body saw the same flow
         }
+    }
 
-        float e = std::min(bodyA.Restitution, bodyB.Restitution);
-        
-        float j = -(1.0f + e) * FlatVector::Dot(relativeVelocity, normal);
-        j /= bodyA.InvMass + bodyB.InvMass;
-        
-        FlatVector impulse = j * normal;
+    void ResolveInteractionBodyAir(int body) {
+        float resistanceCoefficient = bodyStore.GetShape(body).Type == Bodies::ShapeType::Circle ? 0.47f : PolygonResistanceCoefficient;
+        FlatVector bodyLinearVelocity = bodyStore.LinearVelocities[body];
+
+        FlatVector airResistance = -0.5 * 1.293 * resistanceCoefficient * bodyLinearVelocity * FlatVector::VecLen(bodyLinearVelocity) * bodyStore.GetArea(body); // Opr powietrza
 
-        std::lock_guard<std::mutex> lock(intersectionMutex);
-        bodyA.SetlinearVelocity(bodyA.GetlinearVelocity() - impulse * bodyA.InvMass) ;
-        bodyB.SetlinearVelocity(bodyB.GetlinearVelocity() + impulse * bodyB.InvMass);
+        bodyStore.LiquidDisplacements[body] += airResistance;
     }
 
-    void ResolveInteractionBodyAir(Bodies& body) {
-        if (body.Type == Bodies::ShapeType::Circle) {
-            float volume = (4.0f / 3.0f) * 3.1416 * pow(body.Radius, 3);
-            float sphereResistanceCoefficient = 0.47;
-            FlatVector bodyLinearVelocity = body.GetlinearVelocity();
+    // Returns false when the body is not in the liquid. Polygons displace the part of their area
+    // clipped to the liquid's box, circles keep the sphere model below HighestBoundry.
+    bool ResolveInteractionBodyFluid(int body, const AABB& bodyBox, int liquidId) {
+        const Liquids& liquid = liquidList[liquidId];
 
-            FlatVector airResistance = -0.5 * 1.293 * sphereResistanceCoefficient * bodyLinearVelocity * FlatVector::VecLen(bodyLinearVelocity) * body.Area; // Opr powietrza
+        if (bodyStore.GetShape(body).Type == Bodies::ShapeType::Circle) {
+            if (!Intersections::IntersectLiquidCircle(bodyStore.Positions[body], bodyStore.Radii[body], liquid.FluidBoundries)) {
+                return false;
+            }
+            ApplyFluidForces(body, liquid.Density, CheckHowMuchIsUnderWater(body, liquid.HighestBoundry), FlatVector(0.0f, 0.0f));
+            return true;
+        }
 
-            body.LiquidDisplacement += airResistance;
+        const AABB& volume = liquidIndex.GetBounds(liquidId);
+        float submerged = volume.Contains(bodyBox) ? bodyStore.GetArea(body)
+            : Intersections::ClippedArea(bodyStore.GetWorldVertices(body), volume, clipBufferA, clipBufferB);
+        if (submerged <= 0.0f) {
+            return false;
         }
+        ApplyFluidForces(body, liquid.Density, submerged, FlatVector(0.0f, 0.0f));
+        return true;
     }
 
-    void ResolveInteractionBodyFluid(Bodies& body, Liquids& liquid) {
-        if (body.Type == Bodies::ShapeType::Circle) {
-            float volume = (4.0f / 3.0f) * 3.1416 * pow(body.Radius,3);
+    // Buoyancy and drag from the particles within a kernel radius of the body's box. Those beside and
+    // below the body put the surface above themselves by the depth their pressure stands for, and their
+    // mean is the level the liquid model above is applied at, so walls and other bodies in the way do
+    // not lower it. Fluid lying on top of the body only weighs on it and is left out. Drag is against
+    // the mean velocity of all of them, and the opposite force is shared out among them through
+    // fluidReactions. The drag is taken implicitly: its impulse is at most the one that leaves the
+    // body and those particles moving together.
+    bool ResolveInteractionBodyParticles(int body, const AABB& bodyBox, float deltaTime) {
+        AABB region = bodyBox.Fattened(particleFluid.GetSmoothingRadius());
+        particleFluid.Query(region, fluidHits);
+        if (fluidHits.empty()) {
+            return false;
+        }
 
-            float submerged = CheckHowMuchIsUnderWater(body, liquid);
-            float isunder = submerged / volume;
-            FlatVector archimedesForce = -liquid.Density * gravity * submerged; //wyporno
+        float depthPerPressure = gravity.y < 0.0f ? -1.0f / (particleFluid.GetRestDensity() * gravity.y) : 0.0f;
+        FlatVector flowVelocity(0.0f, 0.0f);
+        float level = 0.0f;
+        int levelCount = 0;
+        for (int particle : fluidHits) {
+            flowVelocity += particleFluid.Velocities[particle];
+            const FlatVector& position = particleFluid.Positions[particle];
+            if (position.y < bodyBox.Max.y) {
+                level += position.y + particleFluid.Pressures[particle] * depthPerPressure;
+                levelCount++;
+            }
+        }
+        if (levelCount == 0) {
+            return false;
+        }
+        flowVelocity = flowVelocity / static_cast<float>(fluidHits.size());
+        level = level / levelCount;
+
+        float submerged = bodyStore.GetShape(body).Type == Bodies::ShapeType::Circle ? CheckHowMuchIsUnderWater(body, level)
+            : Intersections::ClippedArea(bodyStore.GetWorldVertices(body), AABB(region.Min, FlatVector(region.Max.x, level)), clipBufferA, clipBufferB);
+        if (submerged <= 0.0f) {
+            return false;
+        }
+
+        float bodyMass = 1.0f / bodyStore.InvMasses[body];
+        float fluidMass = fluidHits.size() * particleFluid.GetParticleMass();
+        float reducedMass = bodyMass * fluidMass / (bodyMass + fluidMass);
+        float maxDrag = reducedMass * FlatVector::VecLen(bodyStore.LinearVelocities[body] - flowVelocity) / deltaTime;
+
+        FlatVector force = ApplyFluidForces(body, particleFluid.GetRestDensity(), submerged, flowVelocity, maxDrag);
+        FlatVector reaction = force * (-deltaTime / fluidMass);
+        for (int particle : fluidHits) {
+            fluidReactions[particle] += reaction;
+        }
+        return true;
+    }
+
+    // Adds buoyancy of the submerged area and drag against the flow, at most maxDrag, to the body, and returns their sum
+    FlatVector ApplyFluidForces(int body, float density, float submerged, const FlatVector& flowVelocity,
+        float maxDrag = std::numeric_limits<float>::max()) {
+        FlatVector bodyLinearVelocity = bodyStore.LinearVelocities[body] - flowVelocity;
+        FlatVector archimedesForce = -density * gravity * submerged; //wyporno
+        FlatVector fluidResistance(0.0f, 0.0f);
 
+        if (bodyStore.GetShape(body).Type == Bodies::ShapeType::Circle) {
             float sphereResistanceCoefficient = 0.47;
-            FlatVector bodyLinearVelocity = body.GetlinearVelocity();
-            float crossSectionalArea = 3.1416 * pow(body.Radius, 2);
-            
-            FlatVector fluidResistance = - 0.5 * bodyLinearVelocity * crossSectionalArea * sphereResistanceCoefficient * liquid.Density * FlatVector::VecLen(bodyLinearVelocity); //Opr wody
+            float crossSectionalArea = 3.1416 * pow(bodyStore.Radii[body], 2);
+
+            fluidResistance = - 0.5 * bodyLinearVelocity * crossSectionalArea * sphereResistanceCoefficient * density * FlatVector::VecLen(bodyLinearVelocity); //Opr wody
+        }
+        else {
+            // Drag on the submerged share of the width facing the flow
+            float speed = FlatVector::VecLen(bodyLinearVelocity);
+            if (speed > 0.0f) {
+                float crossSection = ProjectedWidth(body, FlatVector(-bodyLinearVelocity.y, bodyLinearVelocity.x) / speed) * submerged / bodyStore.GetArea(body);
+                fluidResistance = -0.5f * bodyLinearVelocity * speed * crossSection * PolygonResistanceCoefficient * density;
+            }
+        }
+
+        float drag = FlatVector::VecLen(fluidResistance);
+        if (drag > maxDrag) {
+            fluidResistance = fluidResistance * (maxDrag / drag);
+        }
+
+        bodyStore.LiquidDisplacements[body] += archimedesForce + fluidResistance;
+        return archimedesForce + fluidResistance;
+    }
 
-            body.LiquidDisplacement += archimedesForce + fluidResistance;
+    // Extent of a polygon's world vertices along a unit axis
+    float ProjectedWidth(int body, const FlatVector& axis) const {
+        float min = std::numeric_limits<float>::max();
+        float max = -std::numeric_limits<float>::max();
+        for (const auto& vertex : bodyStore.GetWorldVertices(body)) {
+            float projection = FlatVector::Dot(vertex, axis);
+            min = std::min(min, projection);
+            max = std::max(max, projection);
         }
+        return max - min;
     }
-    float CheckHowMuchIsUnderWater(Bodies& Body, Liquids& Liquid) {
+    float CheckHowMuchIsUnderWater(int body, float surface) {
+        const BodyShape& Body = bodyStore.GetShape(body);
+        float radius = bodyStore.Radii[body];
         float submergedArea = 0;
-        float volume = (4.0f / 3.0f) * 3.1416 * pow(Body.Radius, 3);
+        float volume = (4.0f / 3.0f) * 3.1416 * pow(radius, 3);
 
         if (Body.Type == Bodies::ShapeType::Circle) {
-            float height = Body.Position.y - Liquid.HighestBoundry;
+            float height = bodyStore.Positions[body].y - surface;
 
-            if (height > Body.Radius) {
+            if (height > radius) {
                 submergedArea = 0;
             }
-            else if (height < -Body.Radius) {
+            else if (height < -radius) {
                 submergedArea = volume;
             }
             else {
                 float absHeight = std::fabs(height);
                 if (height < 0) {
-                    float centralAngle = 2.0 * std::acos(absHeight / Body.Radius);
-                    float triangleArea = 0.5 * Body.Radius * Body.Radius * std::sin(centralAngle);
+                    float centralAngle = 2.0 * std::acos(absHeight / radius);
+                    float triangleArea = 0.5 * radius * radius * std::sin(centralAngle);
                     float sectorArea = volume * ((6.2832 - centralAngle) / 6.2832);
                     submergedArea = sectorArea + triangleArea;
                 }
                 else {
-                    float centralAngle = 2.0 * std::acos(absHeight / Body.Radius);
-                    float triangleArea = 0.5 * Body.Radius * Body.Radius * std::sin(centralAngle);
+                    float centralAngle = 2.0 * std::acos(absHeight / radius);
+                    float triangleArea = 0.5 * radius * radius * std::sin(centralAngle);
                     float sectorArea = volume * ((centralAngle) / 6.2832);
                     submergedArea = sectorArea - triangleArea;
                 }